@@ -0,0 +1,683 @@
+\echo Use "ALTER EXTENSION pg_rrule UPDATE TO '0.4.0'" to load this file. \quit
+
+CREATE
+OR REPLACE FUNCTION rrule_in(cstring)
+    RETURNS rrule
+    AS 'MODULE_PATHNAME', 'pg_rrule_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_out(rrule)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME', 'pg_rrule_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_send(rrule)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'pg_rrule_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_recv(internal)
+    RETURNS rrule
+    AS 'MODULE_PATHNAME', 'pg_rrule_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_typanalyze(internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_typanalyze'
+    LANGUAGE C STRICT PARALLEL SAFE;
+
+/*
+ * Values of 0.3.0 are still read, and rewritten in the compact format whenever they are written again. The
+ * alignment can't be changed and stays int, which only costs padding. Columns created before keep plain storage
+ * until ALTER TABLE ... ALTER COLUMN ... SET STORAGE extended.
+ */
+ALTER TYPE rrule SET (
+    analyze = rrule_typanalyze,
+    storage = extended
+);
+
+/* planner support */
+CREATE
+OR REPLACE FUNCTION rrule_occurrences_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_support'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurs_at_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurs_at_support'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+/* occurrences */
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp with time zone)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp with time zone, timestamp with time zone)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart_until_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp)
+    RETURNS timestamp[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp, timestamp)
+    RETURNS timestamp[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart_until'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp with time zone, timestamp with time zone, timestamp with time zone)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_window_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences(rrule, timestamp, timestamp, timestamp)
+    RETURNS timestamp[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_window'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+/* occurrences in a named timezone */
+CREATE
+OR REPLACE FUNCTION get_occurrences_tz(rrule, timestamp with time zone, text)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart_zone'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences_tz(rrule, timestamp with time zone, timestamp with time zone, text)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_dtstart_until_zone'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION get_occurrences_tz(rrule, timestamp with time zone, timestamp with time zone, timestamp with time zone, text)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_occurrences_window_zone'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+/* streaming occurrences */
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp with time zone)
+    RETURNS SETOF timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_dtstart_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp with time zone, timestamp with time zone)
+    RETURNS SETOF timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_dtstart_until_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp)
+    RETURNS SETOF timestamp
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_dtstart'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp, timestamp)
+    RETURNS SETOF timestamp
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_dtstart_until'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp with time zone, timestamp with time zone, timestamp with time zone)
+    RETURNS SETOF timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_window_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences(rrule, timestamp, timestamp, timestamp)
+    RETURNS SETOF timestamp
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_window'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+/* batch occurrences */
+CREATE
+OR REPLACE FUNCTION rrule_occurrences_batch(rrule[], timestamp with time zone[], timestamp with time zone, timestamp with time zone)
+    RETURNS TABLE(idx integer, occurrence timestamp with time zone)
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_batch_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurrences_batch(rrule[], timestamp[], timestamp, timestamp)
+    RETURNS TABLE(idx integer, occurrence timestamp)
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurrences_batch'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurrences_support;
+
+/* scheduling */
+CREATE
+OR REPLACE FUNCTION rrule_next_occurrence(rrule, timestamp with time zone, timestamp with time zone)
+    RETURNS timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_next_occurrence_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_next_occurrence(rrule, timestamp, timestamp)
+    RETURNS timestamp
+    AS 'MODULE_PATHNAME', 'pg_rrule_next_occurrence'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_next_occurrences(rrule, timestamp with time zone, timestamp with time zone, int4)
+    RETURNS timestamp with time zone[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_next_occurrences_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_next_occurrences(rrule, timestamp, timestamp, int4)
+    RETURNS timestamp[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_next_occurrences'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+/* counting */
+CREATE
+OR REPLACE FUNCTION rrule_count_occurrences(rrule, timestamp with time zone, timestamp with time zone, timestamp with time zone)
+    RETURNS int8
+    AS 'MODULE_PATHNAME', 'pg_rrule_count_occurrences_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_count_occurrences(rrule, timestamp, timestamp, timestamp)
+    RETURNS int8
+    AS 'MODULE_PATHNAME', 'pg_rrule_count_occurrences'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+/* membership */
+CREATE
+OR REPLACE FUNCTION rrule_occurs_at(rrule, timestamp with time zone, timestamp with time zone)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurs_at_tz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurs_at_support;
+
+CREATE
+OR REPLACE FUNCTION rrule_occurs_at(rrule, timestamp, timestamp)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_occurs_at'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE SUPPORT rrule_occurs_at_support;
+
+/* span */
+CREATE
+OR REPLACE FUNCTION rrule_span(rrule, timestamp with time zone)
+    RETURNS tstzrange
+    AS 'MODULE_PATHNAME', 'pg_rrule_span_tz'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_span_tz(rrule, timestamp with time zone, text)
+    RETURNS tstzrange
+    AS 'MODULE_PATHNAME', 'pg_rrule_span_zone'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_span(rrule, timestamp)
+    RETURNS tsrange
+    AS 'MODULE_PATHNAME', 'pg_rrule_span'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+/* expanded form */
+CREATE
+OR REPLACE FUNCTION rrule_expand(rrule)
+    RETURNS rrule
+    AS 'MODULE_PATHNAME', 'pg_rrule_expand'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+/* expansion cache */
+CREATE
+OR REPLACE FUNCTION rrule_cache_stats(OUT hits bigint, OUT misses bigint, OUT evictions bigint, OUT shared_hits bigint)
+    AS 'MODULE_PATHNAME', 'pg_rrule_cache_stats'
+    LANGUAGE C VOLATILE STRICT PARALLEL RESTRICTED;
+
+/* operators */
+CREATE
+OR REPLACE FUNCTION rrule_eq(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_eq'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_ne(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_ne'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_lt(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_lt'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_le(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_le'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_gt(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_gt'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_ge(rrule, rrule)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_rrule_ge'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_cmp(rrule, rrule)
+RETURNS int4
+AS 'MODULE_PATHNAME', 'pg_rrule_cmp'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_hash(rrule)
+RETURNS int4
+AS 'MODULE_PATHNAME', 'pg_rrule_hash'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_hash_extended(rrule, int8)
+RETURNS int8
+AS 'MODULE_PATHNAME', 'pg_rrule_hash_extended'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+ALTER OPERATOR = (rrule, rrule) SET (
+    RESTRICT = eqsel,
+    JOIN = eqjoinsel
+);
+
+ALTER OPERATOR <> (rrule, rrule) SET (
+    RESTRICT = neqsel,
+    JOIN = neqjoinsel
+);
+
+CREATE
+OPERATOR < (
+    LEFTARG = rrule,
+    RIGHTARG = rrule,
+    PROCEDURE = rrule_lt,
+    COMMUTATOR = >,
+    NEGATOR = >=,
+    RESTRICT = scalarltsel,
+    JOIN = scalarltjoinsel
+);
+
+CREATE
+OPERATOR <= (
+    LEFTARG = rrule,
+    RIGHTARG = rrule,
+    PROCEDURE = rrule_le,
+    COMMUTATOR = >=,
+    NEGATOR = >,
+    RESTRICT = scalarlesel,
+    JOIN = scalarlejoinsel
+);
+
+CREATE
+OPERATOR > (
+    LEFTARG = rrule,
+    RIGHTARG = rrule,
+    PROCEDURE = rrule_gt,
+    COMMUTATOR = <,
+    NEGATOR = <=,
+    RESTRICT = scalargtsel,
+    JOIN = scalargtjoinsel
+);
+
+CREATE
+OPERATOR >= (
+    LEFTARG = rrule,
+    RIGHTARG = rrule,
+    PROCEDURE = rrule_ge,
+    COMMUTATOR = <=,
+    NEGATOR = <,
+    RESTRICT = scalargesel,
+    JOIN = scalargejoinsel
+);
+
+CREATE OPERATOR CLASS rrule_btree_ops
+    DEFAULT FOR TYPE rrule USING btree AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 rrule_cmp(rrule, rrule);
+
+CREATE OPERATOR CLASS rrule_hash_ops
+    DEFAULT FOR TYPE rrule USING hash AS
+        OPERATOR 1 =,
+        FUNCTION 1 rrule_hash(rrule),
+        FUNCTION 2 rrule_hash_extended(rrule, int8);
+
+/* ALTER OPERATOR can only set HASHES and MERGES from PostgreSQL 17 on */
+UPDATE pg_catalog.pg_operator SET oprcanhash = true, oprcanmerge = true
+    WHERE oid = '=(rrule, rrule)'::pg_catalog.regoperator;
+
+/* FREQ */
+CREATE
+OR REPLACE FUNCTION get_freq(rrule)
+    RETURNS text
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_freq'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* UNTIL */
+CREATE
+OR REPLACE FUNCTION get_until(rrule)
+    RETURNS timestamp
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_until'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* UNTIL TZ */
+CREATE
+OR REPLACE FUNCTION get_untiltz(rrule)
+    RETURNS timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_untiltz'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* COUNT */
+CREATE
+OR REPLACE FUNCTION get_count(rrule)
+    RETURNS int4
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_count'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* INTERVAL */
+CREATE
+OR REPLACE FUNCTION get_interval(rrule)
+    RETURNS int2
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_interval'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYSECOND */
+CREATE
+OR REPLACE FUNCTION get_bysecond(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_bysecond'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYMINUTE */
+CREATE
+OR REPLACE FUNCTION get_byminute(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_byminute'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYHOUR */
+CREATE
+OR REPLACE FUNCTION get_byhour(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_byhour'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYDAY */
+CREATE
+OR REPLACE FUNCTION get_byday(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_byday'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYMONTHDAY */
+CREATE
+OR REPLACE FUNCTION get_bymonthday(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_bymonthday'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYYEARDAY */
+CREATE
+OR REPLACE FUNCTION get_byyearday(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_byyearday'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYWEEKNO */
+CREATE
+OR REPLACE FUNCTION get_byweekno(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_byweekno'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYMONTH */
+CREATE
+OR REPLACE FUNCTION get_bymonth(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_bymonth'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* BYSETPOS */
+CREATE
+OR REPLACE FUNCTION get_bysetpos(rrule)
+    RETURNS int2[]
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_bysetpos'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* WKST */
+CREATE
+OR REPLACE FUNCTION get_wkst(rrule)
+    RETURNS text
+    AS 'MODULE_PATHNAME', 'pg_rrule_get_wkst'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/* series */
+CREATE TYPE rrule_series;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_in(cstring)
+    RETURNS rrule_series
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_in'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_out(rrule_series)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_out'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_send(rrule_series)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_recv(internal)
+    RETURNS rrule_series
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_typanalyze(internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_typanalyze'
+    LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE TYPE rrule_series (
+    input = rrule_series_in,
+    output = rrule_series_out,
+    send = rrule_series_send,
+    receive = rrule_series_recv,
+    analyze = rrule_series_typanalyze,
+    internallength = VARIABLE,
+    alignment = double,
+    storage = extended
+);
+
+CREATE
+OR REPLACE FUNCTION rrule_series(rrule, timestamp with time zone, interval DEFAULT '0')
+    RETURNS rrule_series
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_make'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION get_rrule(rrule_series)
+    RETURNS rrule
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_get_rule'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION get_dtstart(rrule_series)
+    RETURNS timestamp with time zone
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_get_dtstart'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION get_duration(rrule_series)
+    RETURNS interval
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_get_duration'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_overlaps(rrule_series, tstzrange)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_overlaps'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_overlap_sel(internal, oid, internal, integer)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_overlap_sel'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE
+OPERATOR && (
+    LEFTARG = rrule_series,
+    RIGHTARG = tstzrange,
+    PROCEDURE = rrule_series_overlaps,
+    RESTRICT = rrule_series_overlap_sel,
+    JOIN = contjoinsel
+);
+
+/* GiST storage type, only used inside indexes */
+CREATE TYPE rrule_series_key;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_key_in(cstring)
+    RETURNS rrule_series_key
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_key_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_key_out(rrule_series_key)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_key_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE rrule_series_key (
+    input = rrule_series_key_in,
+    output = rrule_series_key_out,
+    internallength = 48,
+    alignment = double
+);
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_consistent(internal, tstzrange, smallint, oid, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_consistent'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_union(internal, internal)
+    RETURNS rrule_series_key
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_union'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_compress(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_compress'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_penalty(internal, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_penalty'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_picksplit(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_picksplit'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_gist_same(rrule_series_key, rrule_series_key, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_gist_same'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS rrule_series_ops
+    DEFAULT FOR TYPE rrule_series USING gist AS
+        OPERATOR 3 && (rrule_series, tstzrange),
+        FUNCTION 1 rrule_series_gist_consistent(internal, tstzrange, smallint, oid, internal),
+        FUNCTION 2 rrule_series_gist_union(internal, internal),
+        FUNCTION 3 rrule_series_gist_compress(internal),
+        FUNCTION 5 rrule_series_gist_penalty(internal, internal, internal),
+        FUNCTION 6 rrule_series_gist_picksplit(internal, internal),
+        FUNCTION 7 rrule_series_gist_same(rrule_series_key, rrule_series_key, internal),
+        STORAGE rrule_series_key;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_brin_opcinfo(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_brin_opcinfo'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_brin_add_value(internal, internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_brin_add_value'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_brin_consistent(internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_brin_consistent'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE
+OR REPLACE FUNCTION rrule_series_brin_union(internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'pg_rrule_series_brin_union'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS rrule_series_brin_ops
+    DEFAULT FOR TYPE rrule_series USING brin AS
+        OPERATOR 3 && (rrule_series, tstzrange),
+        FUNCTION 1 rrule_series_brin_opcinfo(internal),
+        FUNCTION 2 rrule_series_brin_add_value(internal, internal, internal, internal),
+        FUNCTION 3 rrule_series_brin_consistent(internal, internal, internal),
+        FUNCTION 4 rrule_series_brin_union(internal, internal, internal),
+        STORAGE timestamp with time zone;
@@ -2,6 +2,13 @@ SET client_min_messages = warning;
 
 BEGIN;
 
+DROP TYPE rrule_series_key CASCADE;
+DROP TYPE rrule_series CASCADE;
 DROP TYPE rrule CASCADE;
+DROP FUNCTION rrule_occurrences_support(internal);
+DROP FUNCTION rrule_occurs_at_support(internal);
+DROP FUNCTION rrule_typanalyze(internal);
+DROP FUNCTION rrule_series_typanalyze(internal);
+DROP FUNCTION rrule_cache_stats();
 
 COMMIT;
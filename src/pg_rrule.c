@@ -4,7 +4,143 @@
 #include <utils/array.h>
 #include <catalog/pg_type.h>
 #include <utils/lsyscache.h>
+#include <funcapi.h>
+#include <access/htup_details.h>
 #include "utils/builtins.h"
+#include <utils/guc.h>
+#include <miscadmin.h>
+#include <utils/rangetypes.h>
+#include <access/gist.h>
+#include <access/brin_internal.h>
+#include <access/brin_tuple.h>
+#include <access/skey.h>
+#include <utils/datum.h>
+#include <utils/typcache.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/supportnodes.h>
+#include <optimizer/optimizer.h>
+#include <commands/vacuum.h>
+#include <catalog/pg_statistic.h>
+#include <utils/selfuncs.h>
+#include <utils/float.h>
+#if PG_VERSION_NUM >= 140000
+#include <common/hashfn.h>
+#else
+#include <utils/hashutils.h>
+#endif
+
+bool pg_rrule_native_engine = true;
+int pg_rrule_max_occurrences = 1000000;
+int pg_rrule_max_expansion_memory = 0;
+int pg_rrule_limit_action_setting = PG_RRULE_LIMIT_ERROR;
+
+static const struct config_enum_entry pg_rrule_limit_action_options[] = {
+    {"error", PG_RRULE_LIMIT_ERROR, false},
+    {"truncate", PG_RRULE_LIMIT_TRUNCATE, false},
+    {NULL, 0, false}
+};
+
+void _PG_init(void) {
+    DefineCustomBoolVariable("pg_rrule.native_engine",
+                             "Expands the common rule shapes with the built-in engine instead of libical.",
+                             NULL,
+                             &pg_rrule_native_engine,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_rrule.max_occurrences",
+                            "Most occurrences a single expansion may produce.",
+                            "0 means no limit.",
+                            &pg_rrule_max_occurrences,
+                            1000000,
+                            0,
+                            INT_MAX,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_rrule.max_expansion_memory",
+                            "Largest array of occurrences a single call may build.",
+                            "0 means up to the maximum allocation size.",
+                            &pg_rrule_max_expansion_memory,
+                            0,
+                            0,
+                            MAX_KILOBYTES,
+                            PGC_USERSET,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomEnumVariable("pg_rrule.limit_action",
+                             "What to do when an expansion reaches pg_rrule.max_occurrences or pg_rrule.max_expansion_memory.",
+                             "error raises an error, truncate returns the occurrences produced so far.",
+                             &pg_rrule_limit_action_setting,
+                             PG_RRULE_LIMIT_ERROR,
+                             pg_rrule_limit_action_options,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_rrule.cache_size",
+                            "Memory each get_occurrences() call site may use to cache recent results.",
+                            "0 disables the cache.",
+                            &pg_rrule_cache_size,
+                            256,
+                            0,
+                            MAX_KILOBYTES,
+                            PGC_USERSET,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_rrule.shared_cache_size",
+                            "Shared memory for get_occurrences() results reused by all connections.",
+                            "0 disables the cache. Requires pg_rrule in shared_preload_libraries.",
+                            &pg_rrule_shared_cache_size,
+                            0,
+                            0,
+                            INT_MAX / 1024,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_MB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_rrule.shared_cache_max_entries",
+                            "Most get_occurrences() results kept in the shared cache.",
+                            NULL,
+                            &pg_rrule_shared_cache_max_entries,
+                            4096,
+                            1,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    if (process_shared_preload_libraries_in_progress) {
+        pg_rrule_shared_cache_install();
+    }
+
+#if PG_VERSION_NUM >= 150000
+    MarkGUCPrefixReserved("pg_rrule");
+#else
+    EmitWarningsOnPlaceholders("pg_rrule");
+#endif
+}
 
 Datum pg_rrule_in(PG_FUNCTION_ARGS) {
     const char* const rrule_str = PG_GETARG_CSTRING(0);
@@ -20,98 +156,25 @@ Datum pg_rrule_in(PG_FUNCTION_ARGS) {
                  errhint("You need to omit \"RRULE:\" part of expression (if present)")));
     }
 
-    // Calculate the total size needed for flattened storage
-    size_t base_size = sizeof(struct icalrecurrencetype);
-    size_t arrays_size = 0;
-    size_t rscale_size = 0;
-
-    // Calculate space needed for by arrays
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (recurrence->by[i].size > 0) {
-            arrays_size += recurrence->by[i].size * sizeof(short);
-        }
-    }
-
-    // Calculate space needed for rscale
-    if (recurrence->rscale) {
-        rscale_size = strlen(recurrence->rscale) + 1;
-    }
-
-    size_t total_size = base_size + arrays_size + rscale_size;
-
-    // Allocate flattened structure
-    char *flattened = palloc0(VARHDRSZ + total_size);
-    SET_VARSIZE(flattened, VARHDRSZ + total_size);
-
-    // Copy base structure (but we'll fix the pointers)
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(flattened);
-    memcpy(flat_struct, recurrence, sizeof(struct icalrecurrencetype));
-    flat_struct->refcount = 1;
-
-    // Current position for variable data (after the base struct)
-    char *var_data_pos = VARDATA(flattened) + base_size;
-
-    // Copy and relocate by arrays
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (recurrence->by[i].size > 0 && recurrence->by[i].data) {
-            size_t array_bytes = recurrence->by[i].size * sizeof(short);
-
-            // Copy array data to our flattened buffer
-            memcpy(var_data_pos, recurrence->by[i].data, array_bytes);
-
-            // Store offset from the start of VARDATA (not absolute pointer)
-            size_t offset = var_data_pos - VARDATA(flattened);
-            flat_struct->by[i].data = (short*)offset;
-            flat_struct->by[i].size = recurrence->by[i].size;
-
-            var_data_pos += array_bytes;
-        } else {
-            flat_struct->by[i].data = NULL;
-            flat_struct->by[i].size = 0;
-        }
+    // Stored values are validated when decoded, so reject what decoding would
+    const char *invalid = pg_rrule_validate(recurrence);
+    if (invalid != NULL) {
+        icalrecurrencetype_unref(recurrence);
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Can't parse RRULE. %s is out of range. RRULE \"%s\".", invalid, rrule_str)));
     }
 
-    // Copy and relocate rscale
-    if (recurrence->rscale) {
-        memcpy(var_data_pos, recurrence->rscale, rscale_size);
-        // Store as offset from start of VARDATA
-        size_t offset = var_data_pos - VARDATA(flattened);
-        flat_struct->rscale = (char*)offset;
-        var_data_pos += rscale_size;
-    } else {
-        flat_struct->rscale = NULL;
-    }
+    struct varlena *result = pg_rrule_encode(recurrence);
 
     icalrecurrencetype_unref(recurrence);
-    PG_RETURN_POINTER(flattened);
+    PG_RETURN_POINTER(result);
 }
 
 Datum pg_rrule_out(PG_FUNCTION_ARGS) {
-    char *flattened = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(flattened);
-
-    // Create a temporary struct with real pointers for libical
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
-    memcpy(&tmp, flat_struct, sizeof(struct icalrecurrencetype));
-
-    char *base_addr = VARDATA(flattened);
-
-    // Convert offsets back to real pointers for by arrays
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (flat_struct->by[i].size > 0 && flat_struct->by[i].data != NULL) {
-            // Convert offset back to pointer
-            size_t offset = (size_t)flat_struct->by[i].data;
-            tmp.by[i].data = (short*)(base_addr + offset);
-        } else {
-            tmp.by[i].data = NULL;
-        }
-    }
-
-    // Convert rscale offset back to pointer
-    if (flat_struct->rscale != NULL) {
-        size_t offset = (size_t)flat_struct->rscale;
-        tmp.rscale = base_addr + offset;
-    }
+    flatten_to_tmp(varlena_data, &tmp);
 
     char *const rrule_str = icalrecurrencetype_as_string(&tmp);
     const icalerrorenum err = icalerrno;
@@ -138,359 +201,1843 @@ Datum pg_rrule_out(PG_FUNCTION_ARGS) {
 }
 
 Datum pg_rrule_send(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
-
-    char *base_addr = VARDATA(varlena_data);
+    // The wire format is the on-disk format, so current values go out as is
+    Size len;
+    const char *data = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &len);
 
     StringInfoData buf;
     pq_begintypsend(&buf);
+    pq_sendbytes(&buf, data, (int) len);
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum pg_rrule_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
 
-    pq_sendint32(&buf, flat_struct->refcount);
-    pq_sendint32(&buf, (int32)flat_struct->freq);
-    pq_sendint32(&buf, flat_struct->count);
-    pq_sendint16(&buf, flat_struct->interval);
-    pq_sendint32(&buf, (int32)flat_struct->week_start);
-    pq_sendint32(&buf, (int32)flat_struct->skip);
-    pq_sendint32(&buf, flat_struct->until.year);
-    pq_sendint32(&buf, flat_struct->until.month);
-    pq_sendint32(&buf, flat_struct->until.day);
-    pq_sendint32(&buf, flat_struct->until.hour);
-    pq_sendint32(&buf, flat_struct->until.minute);
-    pq_sendint32(&buf, flat_struct->until.second);
-    pq_sendint32(&buf, flat_struct->until.is_date);
-    
-    if (flat_struct->rscale != NULL) {
-        size_t rscale_offset = (size_t)flat_struct->rscale;
-        char *real_rscale = base_addr + rscale_offset;
-        int32 len = strlen(real_rscale);
-        pq_sendint32(&buf, len);
-        pq_sendbytes(&buf, real_rscale, len);
+    struct icalrecurrencetype tmp;
+    if (buf->cursor < buf->len && (unsigned char) buf->data[buf->cursor] == PG_RRULE_FORMAT_V2) {
+        // Validates the payload; re-encoding below makes it canonical
+        const int len = buf->len - buf->cursor;
+        pg_rrule_decode(pq_getmsgbytes(buf, len), (Size) len, &tmp);
     } else {
-        pq_sendint32(&buf, -1); // NULL marker
+        pg_rrule_recv_legacy(buf, &tmp);
     }
+    pq_getmsgend(buf);
 
-    // Send the "by" arrays (convert offsets to pointers)
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (flat_struct->by[i].size > 0 && flat_struct->by[i].data != NULL) {
-            pq_sendint16(&buf, flat_struct->by[i].size);
-
-            // Convert offset to a real pointer
-            size_t offset = (size_t)flat_struct->by[i].data;
-            short *real_data = (short*)(base_addr + offset);
+    PG_RETURN_POINTER(pg_rrule_encode(&tmp));
+}
 
-            // Send each short individually
-            for (int j = 0; j < flat_struct->by[i].size; j++) {
-                pq_sendint16(&buf, real_data[j]);
-            }
-        } else {
-            pq_sendint16(&buf, 0);
-        }
+/* occurrences */
+Datum pg_rrule_get_occurrences_dtstart_tz(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_SESSION_TZ, &cached)) {
+        PG_RETURN_DATUM(cached);
     }
 
-    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+
+    icaltimezone *ical_tz = pg_rrule_get_session_timezone();
+
+    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, ical_tz);
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences(tmp, dtstart, true));
 }
 
-Datum pg_rrule_recv(PG_FUNCTION_ARGS) {
-    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+Datum pg_rrule_get_occurrences_dtstart_until_tz(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_SESSION_TZ, &cached)) {
+        PG_RETURN_DATUM(cached);
+    }
 
-    // First, receive all data into temporary variables
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
-    memset(&tmp, 0, sizeof(tmp));
+    flatten_to_tmp(varlena_data, &tmp);
 
-    // Receive basic fields
-    tmp.refcount = pq_getmsgint(buf, 4);
-    tmp.freq = (icalrecurrencetype_frequency)pq_getmsgint(buf, 4);
-    tmp.count = pq_getmsgint(buf, 4);
-    tmp.interval = pq_getmsgint(buf, 2);
-    tmp.week_start = (icalrecurrencetype_weekday)pq_getmsgint(buf, 4);
-    tmp.skip = (icalrecurrencetype_skip)pq_getmsgint(buf, 4);
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(2);
 
-    // Receive until time
-    tmp.until.year = pq_getmsgint(buf, 4);
-    tmp.until.month = pq_getmsgint(buf, 4);
-    tmp.until.day = pq_getmsgint(buf, 4);
-    tmp.until.hour = pq_getmsgint(buf, 4);
-    tmp.until.minute = pq_getmsgint(buf, 4);
-    tmp.until.second = pq_getmsgint(buf, 4);
-    tmp.until.is_date = pq_getmsgint(buf, 4);
+    icaltimezone *ical_tz = pg_rrule_get_session_timezone();
 
-    // Receive rscale
-    char *temp_rscale = NULL;
-    size_t rscale_size = 0;
-    int32 rscale_len = pq_getmsgint(buf, 4);
-    if (rscale_len >= 0) {
-        temp_rscale = palloc(rscale_len + 1);
-        memcpy(temp_rscale, pq_getmsgbytes(buf, rscale_len), rscale_len);
-        temp_rscale[rscale_len] = '\0';
-        rscale_size = rscale_len + 1;
+    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
+    pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(until_ts);
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, ical_tz);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, ical_tz);
+
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_until(tmp, dtstart, until, true));
+}
+
+Datum pg_rrule_get_occurrences_dtstart(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, 0, &cached)) {
+        PG_RETURN_DATUM(cached);
     }
 
-    // Receive by arrays into temporary storage
-    short *temp_arrays[ICAL_BY_NUM_PARTS];
-    size_t arrays_size = 0;
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
 
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        short size = pq_getmsgint(buf, 2);
-        tmp.by[i].size = size;
+    Timestamp dtstart_ts = PG_GETARG_TIMESTAMP(1);
 
-        if (size > 0) {
-            temp_arrays[i] = palloc(size * sizeof(short));
-            arrays_size += size * sizeof(short);
+    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences(tmp, dtstart, false));
+}
 
-            // Receive each short individually
-            for (int j = 0; j < size; j++) {
-                temp_arrays[i][j] = pq_getmsgint(buf, 2);
-            }
-        } else {
-            temp_arrays[i] = NULL;
-        }
+Datum pg_rrule_get_occurrences_dtstart_until(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, 0, &cached)) {
+        PG_RETURN_DATUM(cached);
     }
 
-    // Now create the flattened structure (same logic as pg_rrule_in)
-    size_t base_size = sizeof(struct icalrecurrencetype);
-    size_t total_size = base_size + arrays_size + rscale_size;
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    Timestamp dtstart_ts = PG_GETARG_TIMESTAMP(1);
+    Timestamp until_ts = PG_GETARG_TIMESTAMP(2);
+
+    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
+    pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(until_ts);
 
-    // Allocate flattened structure
-    char *flattened = palloc0(VARHDRSZ + total_size);
-    SET_VARSIZE(flattened, VARHDRSZ + total_size);
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
 
-    // Copy base structure
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(flattened);
-    memcpy(flat_struct, &tmp, sizeof(struct icalrecurrencetype));
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_until(tmp, dtstart, until, false));
+}
 
-    // Current position for variable data (after the base struct)
-    char *var_data_pos = VARDATA(flattened) + base_size;
+Datum pg_rrule_get_occurrences_window_tz(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_SESSION_TZ, &cached)) {
+        PG_RETURN_DATUM(cached);
+    }
 
-    // Copy and relocate by arrays
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (tmp.by[i].size > 0 && temp_arrays[i]) {
-            size_t array_bytes = tmp.by[i].size * sizeof(short);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
 
-            // Copy array data to our flattened buffer
-            memcpy(var_data_pos, temp_arrays[i], array_bytes);
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz from_ts = PG_GETARG_TIMESTAMPTZ(2);
+    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(3);
 
-            // Store offset from start of VARDATA (not absolute pointer)
-            size_t offset = var_data_pos - VARDATA(flattened);
-            flat_struct->by[i].data = (short*)offset;
-            flat_struct->by[i].size = tmp.by[i].size;
+    icaltimezone *ical_tz = pg_rrule_get_session_timezone();
 
-            var_data_pos += array_bytes;
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype from = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(from_ts), 0, ical_tz);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(until_ts), 0, ical_tz);
 
-            // Free temporary array
-            pfree(temp_arrays[i]);
-        } else {
-            flat_struct->by[i].data = NULL;
-            flat_struct->by[i].size = 0;
-        }
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_between(tmp, dtstart, from, until, true));
+}
+
+Datum pg_rrule_get_occurrences_window(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, 0, &cached)) {
+        PG_RETURN_DATUM(cached);
     }
 
-    // Copy and relocate rscale
-    if (temp_rscale) {
-        memcpy(var_data_pos, temp_rscale, rscale_size);
-        // Store as offset from start of VARDATA
-        size_t offset = var_data_pos - VARDATA(flattened);
-        flat_struct->rscale = (char*)offset;
-        var_data_pos += rscale_size;
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    Timestamp dtstart_ts = PG_GETARG_TIMESTAMP(1);
+    Timestamp from_ts = PG_GETARG_TIMESTAMP(2);
+    Timestamp until_ts = PG_GETARG_TIMESTAMP(3);
 
-        // Free temporary rscale
-        pfree(temp_rscale);
-    } else {
-        flat_struct->rscale = NULL;
-    }
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, utc);
+    struct icaltimetype from = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(from_ts), 0, utc);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(until_ts), 0, utc);
 
-    // Return the flattened varlena structure
-    PG_RETURN_POINTER(flattened);
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_between(tmp, dtstart, from, until, false));
 }
 
-/* occurrences */
-Datum pg_rrule_get_occurrences_dtstart_tz(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+Datum pg_rrule_get_occurrences_dtstart_zone(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_ZONE_ARG, &cached)) {
+        PG_RETURN_DATUM(cached);
+    }
+
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
     TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
 
-    long int gmtoff = 0;
-    icaltimezone *ical_tz = NULL;
-    if (pg_get_timezone_offset(session_timezone, &gmtoff)) {
-        ical_tz = icaltimezone_get_builtin_timezone_from_offset(gmtoff, pg_get_timezone_name(session_timezone));
-    }
+    icaltimezone *ical_tz = pg_rrule_get_named_timezone(PG_GETARG_TEXT_PP(2));
 
-    if (ical_tz == NULL) {
-        elog(WARNING, "Can't get timezone from current session! Fallback to UTC.");
-        ical_tz = icaltimezone_get_utc_timezone();
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences(tmp, dtstart, true));
+}
+
+Datum pg_rrule_get_occurrences_dtstart_until_zone(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_ZONE_ARG, &cached)) {
+        PG_RETURN_DATUM(cached);
     }
 
-    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
-    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, ical_tz);
-    return pg_rrule_get_occurrences(tmp, dtstart, true);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(2);
+
+    icaltimezone *ical_tz = pg_rrule_get_named_timezone(PG_GETARG_TEXT_PP(3));
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(until_ts), 0, ical_tz);
+
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_until(tmp, dtstart, until, true));
 }
 
-Datum pg_rrule_get_occurrences_dtstart_until_tz(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+Datum pg_rrule_get_occurrences_window_zone(PG_FUNCTION_ARGS) {
+    Datum cached;
+    if (pg_rrule_cache_lookup(fcinfo, PG_RRULE_CACHE_ZONE_ARG, &cached)) {
+        PG_RETURN_DATUM(cached);
+    }
+
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
     TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
-    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(2);
+    TimestampTz from_ts = PG_GETARG_TIMESTAMPTZ(2);
+    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(3);
 
-    long int gmtoff = 0;
-    icaltimezone *ical_tz = NULL;
-    if (pg_get_timezone_offset(session_timezone, &gmtoff)) {
-        ical_tz = icaltimezone_get_builtin_timezone_from_offset(gmtoff, pg_get_timezone_name(session_timezone));
+    icaltimezone *ical_tz = pg_rrule_get_named_timezone(PG_GETARG_TEXT_PP(4));
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype from = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(from_ts), 0, ical_tz);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(until_ts), 0, ical_tz);
+
+    return pg_rrule_cache_store(fcinfo, pg_rrule_get_occurrences_between(tmp, dtstart, from, until, true));
+}
+
+/* streaming occurrences */
+/*
+ * Shared body of the rrule_occurrences() overloads: (rrule, dtstart), (rrule, dtstart, until)
+ * and (rrule, dtstart, window_start, window_end).
+ */
+static Datum pg_rrule_occurrences_srf(FunctionCallInfo fcinfo, bool use_tz) {
+    FuncCallContext *funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        // The iterator reads the BY* arrays in place, so decode them in the multi-call context,
+        // from a copy of our own: an expanded argument may go away between calls
+        char *varlena_data = (char*) PG_GETARG_RRULE_FLAT_P(0);
+
+        struct icalrecurrencetype tmp;
+        flatten_to_tmp(varlena_data, &tmp);
+
+        icaltimezone *ical_tz = use_tz ? pg_rrule_get_session_timezone() : icaltimezone_get_utc_timezone();
+
+        pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(1));
+        struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, ical_tz);
+        struct icaltimetype from = icaltime_null_time();
+        struct icaltimetype until = icaltime_null_time();
+        if (PG_NARGS() == 3) {
+            pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(2));
+            until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, ical_tz);
+        } else if (PG_NARGS() == 4) {
+            pg_time_t from_ts_pg_time_t = timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(2));
+            pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(3));
+            from = icaltime_from_timet_with_zone((time_t) from_ts_pg_time_t, 0, ical_tz);
+            until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, ical_tz);
+        }
+
+        pg_rrule_iterator *iter = palloc0(sizeof(pg_rrule_iterator));
+        pg_rrule_iterator_init(iter, tmp, dtstart, until);
+        if (!icaltime_is_null_time(from)) {
+            pg_rrule_iterator_seek(iter, from);
+        }
+
+        // Created in the multi-call context, the libical iterator is freed with it even if the
+        // scan is abandoned early
+        funcctx->user_fctx = iter;
+        MemoryContextSwitchTo(oldcontext);
     }
 
-    if (ical_tz == NULL) {
-        elog(WARNING, "Can't get timezone from current session! Fallback to UTC.");
-        ical_tz = icaltimezone_get_utc_timezone();
+    funcctx = SRF_PERCALL_SETUP();
+    pg_rrule_iterator *iter = (pg_rrule_iterator *) funcctx->user_fctx;
+
+    pg_time_t occurrence;
+    if (pg_rrule_iterator_next(iter, &occurrence)) {
+        if (use_tz) {
+            SRF_RETURN_NEXT(funcctx, TimestampTzGetDatum(time_t_to_timestamptz(occurrence)));
+        }
+        SRF_RETURN_NEXT(funcctx, TimestampGetDatum(time_t_to_timestamptz(occurrence)));
     }
 
-    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
-    pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(until_ts);
+    pg_rrule_iterator_free(iter);
+    SRF_RETURN_DONE(funcctx);
+}
 
-    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, ical_tz);
-    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, ical_tz);
+Datum pg_rrule_occurrences_dtstart_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, true);
+}
 
-    return pg_rrule_get_occurrences_until(tmp, dtstart, until, true);
+Datum pg_rrule_occurrences_dtstart_until_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, true);
 }
 
-Datum pg_rrule_get_occurrences_dtstart(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+Datum pg_rrule_occurrences_dtstart(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, false);
+}
+
+Datum pg_rrule_occurrences_dtstart_until(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, false);
+}
+
+Datum pg_rrule_occurrences_window_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, true);
+}
+
+Datum pg_rrule_occurrences_window(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_srf(fcinfo, false);
+}
+
+/* batch occurrences */
+typedef struct pg_rrule_batch_key_entry {
+    uint64 hash;                        /* hash key */
+    int item;                           /* first item with this hash */
+} pg_rrule_batch_key_entry;
+
+typedef struct pg_rrule_batch_state {
+    int nitems;
+    int lbound;                         /* subscript of the first item */
+    Datum *rules;
+    bool *rule_nulls;
+    Datum *dtstarts;
+    bool *dtstart_nulls;
+    int *source;                        /* first item with the same rule and dtstart */
+    bool *reused;                       /* a later item has the same rule and dtstart */
+    ArrayType **saved;                  /* occurrences of reused items */
+    icaltimezone *zone;
+    struct icaltimetype from;
+    struct icaltimetype until;
+    bool use_tz;
+    MemoryContext item_context;         /* reset for every item */
+    int item;                           /* item being returned, -1 before the first */
+    ArrayType *occurrences;             /* occurrences of `item` */
+    int position;                       /* next occurrence of `item` to return */
+} pg_rrule_batch_state;
+
+/*
+ * Find items repeating an earlier (rule, dtstart) pair, so that each distinct
+ * pair is expanded once per batch.
+ */
+static void pg_rrule_batch_dedup(pg_rrule_batch_state *state) {
+    state->source = palloc(state->nitems * sizeof(int));
+    state->reused = palloc0(state->nitems * sizeof(bool));
+    state->saved = palloc0(state->nitems * sizeof(ArrayType *));
+
+    HASHCTL ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(uint64);
+    ctl.entrysize = sizeof(pg_rrule_batch_key_entry);
+    ctl.hcxt = CurrentMemoryContext;
+    HTAB *seen = hash_create("pg_rrule batch", Max(state->nitems, 16), &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+    for (int i = 0; i < state->nitems; i++) {
+        state->source[i] = i;
+        if (state->rule_nulls[i] || state->dtstart_nulls[i]) {
+            continue;
+        }
+
+        Size len;
+        const char *rule = pg_rrule_canonical(pg_rrule_detoast(state->rules[i]), &len);
+        const uint64 hash = DatumGetUInt64(hash_any_extended((const unsigned char *) rule, (int) len,
+                                                             (uint64) DatumGetInt64(state->dtstarts[i])));
+
+        bool found;
+        pg_rrule_batch_key_entry *entry = hash_search(seen, &hash, HASH_ENTER, &found);
+        if (!found) {
+            entry->item = i;
+            continue;
+        }
+
+        // A hash collision just means expanding this item on its own
+        const int first = entry->item;
+        Size first_len;
+        const char *first_rule = pg_rrule_canonical(pg_rrule_detoast(state->rules[first]), &first_len);
+        if (DatumGetInt64(state->dtstarts[first]) == DatumGetInt64(state->dtstarts[i]) &&
+            first_len == len && memcmp(first_rule, rule, len) == 0) {
+            state->source[i] = first;
+            state->reused[first] = true;
+        }
+    }
+
+    hash_destroy(seen);
+}
+
+static ArrayType *pg_rrule_batch_expand(pg_rrule_batch_state *state, int item) {
     struct icalrecurrencetype tmp;
-    flatten_to_tmp(varlena_data, &tmp);
+    flatten_to_tmp((char *) pg_rrule_detoast(state->rules[item]), &tmp);
 
-    Timestamp dtstart_ts = PG_GETARG_TIMESTAMP(1);
+    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(DatumGetTimestampTz(state->dtstarts[item]));
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, state->zone);
 
-    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
-    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
-    return pg_rrule_get_occurrences(tmp, dtstart, false);
+    pg_rrule_iterator iter;
+    pg_rrule_iterator_init(&iter, tmp, dtstart, state->until);
+    pg_rrule_iterator_seek(&iter, state->from);
+
+    ArrayType *occurrences = pg_rrule_build_occurrence_array(&iter, state->use_tz ? TIMESTAMPTZOID : TIMESTAMPOID);
+    pg_rrule_iterator_free(&iter);
+
+    return occurrences;
 }
 
-Datum pg_rrule_get_occurrences_dtstart_until(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+/* Move to the next item with a rule and a dtstart; false at the end of the batch */
+static bool pg_rrule_batch_advance(pg_rrule_batch_state *state, MemoryContext multi_call_context) {
+    while (++state->item < state->nitems) {
+        const int item = state->item;
+        if (state->rule_nulls[item] || state->dtstart_nulls[item]) {
+            continue;
+        }
+
+        state->position = 0;
+        if (state->source[item] != item) {
+            state->occurrences = state->saved[state->source[item]];
+            return true;
+        }
+
+        MemoryContextReset(state->item_context);
+        MemoryContext old_context = MemoryContextSwitchTo(state->item_context);
+        state->occurrences = pg_rrule_batch_expand(state, item);
+        MemoryContextSwitchTo(old_context);
+
+        if (state->reused[item]) {
+            state->saved[item] = (ArrayType *) MemoryContextAlloc(multi_call_context, VARSIZE(state->occurrences));
+            memcpy(state->saved[item], state->occurrences, VARSIZE(state->occurrences));
+            state->occurrences = state->saved[item];
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Shared body of the rrule_occurrences_batch() overloads: (rrule[], dtstart[], window_start,
+ * window_end), returning (idx, occurrence) rows for every item of the arrays.
+ */
+static Datum pg_rrule_occurrences_batch_srf(FunctionCallInfo fcinfo, bool use_tz) {
+    FuncCallContext *funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        ArrayType *rules = PG_GETARG_ARRAYTYPE_P_COPY(0);
+        ArrayType *dtstarts = PG_GETARG_ARRAYTYPE_P_COPY(1);
+        if (ARR_NDIM(rules) > 1 || ARR_NDIM(dtstarts) > 1) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                     errmsg("rrule_occurrences_batch expects one-dimensional arrays")));
+        }
+
+        pg_rrule_batch_state *state = palloc0(sizeof(pg_rrule_batch_state));
+
+        // Setup shared by the whole batch: element types, zone and window
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        get_typlenbyvalalign(ARR_ELEMTYPE(rules), &typlen, &typbyval, &typalign);
+        deconstruct_array(rules, ARR_ELEMTYPE(rules), typlen, typbyval, typalign,
+                          &state->rules, &state->rule_nulls, &state->nitems);
+
+        int ndtstarts;
+        get_typlenbyvalalign(ARR_ELEMTYPE(dtstarts), &typlen, &typbyval, &typalign);
+        deconstruct_array(dtstarts, ARR_ELEMTYPE(dtstarts), typlen, typbyval, typalign,
+                          &state->dtstarts, &state->dtstart_nulls, &ndtstarts);
+
+        if (state->nitems != ndtstarts) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                     errmsg("rrule_occurrences_batch expects as many dtstarts as rules"),
+                     errdetail("Got %d rules and %d dtstarts.", state->nitems, ndtstarts)));
+        }
+
+        state->lbound = ARR_NDIM(rules) == 1 ? ARR_LBOUND(rules)[0] : 1;
+        state->use_tz = use_tz;
+        state->zone = use_tz ? pg_rrule_get_session_timezone() : icaltimezone_get_utc_timezone();
+        state->from = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(2)), 0, state->zone);
+        state->until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(PG_GETARG_TIMESTAMPTZ(3)), 0, state->zone);
+        state->item_context = AllocSetContextCreate(funcctx->multi_call_memory_ctx,
+                                                    "pg_rrule batch item",
+                                                    ALLOCSET_DEFAULT_SIZES);
+        state->item = -1;
+
+        pg_rrule_batch_dedup(state);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            elog(ERROR, "return type must be a row type");
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        funcctx->user_fctx = state;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    pg_rrule_batch_state *state = (pg_rrule_batch_state *) funcctx->user_fctx;
+
+    while (state->occurrences == NULL || state->position >= ARR_DIMS(state->occurrences)[0]) {
+        if (!pg_rrule_batch_advance(state, funcctx->multi_call_memory_ctx)) {
+            SRF_RETURN_DONE(funcctx);
+        }
+        // Empty arrays have no dimensions
+        if (ARR_NDIM(state->occurrences) == 0) {
+            state->occurrences = NULL;
+        }
+    }
+
+    Datum values[2] = {
+        Int32GetDatum(state->lbound + state->item),
+        TimestampGetDatum(((Timestamp *) ARR_DATA_PTR(state->occurrences))[state->position++]),
+    };
+    bool nulls[2] = {false, false};
+
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc, values, nulls)));
+}
+
+Datum pg_rrule_occurrences_batch_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_batch_srf(fcinfo, true);
+}
+
+Datum pg_rrule_occurrences_batch(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurrences_batch_srf(fcinfo, false);
+}
+
+/* scheduling */
+
+/*
+ * Sets up an iterator positioned at the first occurrence strictly after the `after` argument.
+ * Arguments are (rrule, dtstart, after, ...).
+ */
+static void pg_rrule_next_setup(FunctionCallInfo fcinfo, bool use_tz, pg_rrule_iterator *iter) {
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
-    Timestamp dtstart_ts = PG_GETARG_TIMESTAMP(1);
-    Timestamp until_ts = PG_GETARG_TIMESTAMP(2);
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz after_ts = PG_GETARG_TIMESTAMPTZ(2);
 
-    pg_time_t dtstart_ts_pg_time_t = timestamptz_to_time_t(dtstart_ts);
-    pg_time_t until_ts_pg_time_t = timestamptz_to_time_t(until_ts);
+    icaltimezone *ical_tz = use_tz ? pg_rrule_get_session_timezone() : icaltimezone_get_utc_timezone();
 
-    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) dtstart_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
-    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) until_ts_pg_time_t, 0, icaltimezone_get_utc_timezone());
+    // Occurrences fall on whole seconds, so "> after" is ">= the first whole second past after"
+    pg_time_t after_pg_time_t = timestamptz_to_time_t(after_ts);
+    if (time_t_to_timestamptz(after_pg_time_t) <= after_ts) {
+        after_pg_time_t++;
+    }
 
-    return pg_rrule_get_occurrences_until(tmp, dtstart, until, false);
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype from = icaltime_from_timet_with_zone((time_t) after_pg_time_t, 0, ical_tz);
+
+    pg_rrule_iterator_init(iter, tmp, dtstart, icaltime_null_time());
+    pg_rrule_iterator_seek(iter, from);
 }
 
-/* operators */
-Datum pg_rrule_eq(PG_FUNCTION_ARGS) {
-    char *varlena_data1 = (char*) PG_GETARG_POINTER(0);
-    char *varlena_data2 = (char*) PG_GETARG_POINTER(1);
-
-    struct icalrecurrencetype tmp1, tmp2;
-    flatten_to_tmp(varlena_data1, &tmp1);
-    flatten_to_tmp(varlena_data2, &tmp2);
-
-    // Compare basic fields
-    if (tmp1.freq != tmp2.freq ||
-        tmp1.interval != tmp2.interval ||
-        tmp1.count != tmp2.count ||
-        tmp1.week_start != tmp2.week_start) {
-        PG_RETURN_BOOL(false);
+static Datum pg_rrule_next_occurrence_common(FunctionCallInfo fcinfo, bool use_tz) {
+    pg_rrule_iterator iter;
+    pg_rrule_next_setup(fcinfo, use_tz, &iter);
+
+    pg_time_t occurrence;
+    const bool found = pg_rrule_iterator_next(&iter, &occurrence);
+    pg_rrule_iterator_free(&iter);
+
+    if (!found) {
+        PG_RETURN_NULL();
+    }
+
+    if (use_tz) {
+        PG_RETURN_TIMESTAMPTZ(time_t_to_timestamptz(occurrence));
+    }
+    PG_RETURN_TIMESTAMP(time_t_to_timestamptz(occurrence));
+}
+
+static Datum pg_rrule_next_occurrences_common(FunctionCallInfo fcinfo, bool use_tz) {
+    const int32 n = PG_GETARG_INT32(3);
+    const Oid ts_oid = use_tz ? TIMESTAMPTZOID : TIMESTAMPOID;
+
+    if (n <= 0) {
+        PG_RETURN_ARRAYTYPE_P(construct_empty_array(ts_oid));
+    }
+
+    pg_rrule_iterator iter;
+    pg_rrule_next_setup(fcinfo, use_tz, &iter);
+    iter.limit = n;
+
+    ArrayType *result_array = pg_rrule_build_occurrence_array(&iter, ts_oid);
+    pg_rrule_iterator_free(&iter);
+
+    PG_RETURN_ARRAYTYPE_P(result_array);
+}
+
+Datum pg_rrule_next_occurrence_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_next_occurrence_common(fcinfo, true);
+}
+
+Datum pg_rrule_next_occurrence(PG_FUNCTION_ARGS) {
+    return pg_rrule_next_occurrence_common(fcinfo, false);
+}
+
+Datum pg_rrule_next_occurrences_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_next_occurrences_common(fcinfo, true);
+}
+
+Datum pg_rrule_next_occurrences(PG_FUNCTION_ARGS) {
+    return pg_rrule_next_occurrences_common(fcinfo, false);
+}
+
+/* counting */
+static Datum pg_rrule_count_occurrences_common(FunctionCallInfo fcinfo, bool use_tz) {
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz from_ts = PG_GETARG_TIMESTAMPTZ(2);
+    TimestampTz until_ts = PG_GETARG_TIMESTAMPTZ(3);
+
+    icaltimezone *ical_tz = use_tz ? pg_rrule_get_session_timezone() : icaltimezone_get_utc_timezone();
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype from = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(from_ts), 0, ical_tz);
+    struct icaltimetype until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(until_ts), 0, ical_tz);
+
+    pg_rrule_arith arith;
+    if (pg_rrule_arith_init(&tmp, dtstart, &arith)) {
+        PG_RETURN_INT64(pg_rrule_arith_count(&arith, pg_rrule_civil_seconds(from), pg_rrule_civil_seconds(until)));
+    }
+
+    pg_rrule_iterator iter;
+    pg_rrule_iterator_init(&iter, tmp, dtstart, until);
+    pg_rrule_iterator_seek(&iter, from);
+
+    int64 cnt = 0;
+    pg_time_t occurrence;
+    while (pg_rrule_iterator_next(&iter, &occurrence)) {
+        cnt++;
+    }
+
+    pg_rrule_iterator_free(&iter);
+    PG_RETURN_INT64(cnt);
+}
+
+Datum pg_rrule_count_occurrences_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_count_occurrences_common(fcinfo, true);
+}
+
+Datum pg_rrule_count_occurrences(PG_FUNCTION_ARGS) {
+    return pg_rrule_count_occurrences_common(fcinfo, false);
+}
+
+/* membership */
+static Datum pg_rrule_occurs_at_common(FunctionCallInfo fcinfo, bool use_tz) {
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+    TimestampTz ts = PG_GETARG_TIMESTAMPTZ(2);
+
+    // Expansion starts from DTSTART truncated to the second, toward zero like timestamptz_to_time_t()
+    const TimestampTz dtstart_second = dtstart_ts - dtstart_ts % USECS_PER_SEC;
+
+    // Occurrences never precede DTSTART and always fall on whole seconds
+    if (ts < dtstart_second || ts % USECS_PER_SEC != 0) {
+        PG_RETURN_BOOL(false);
+    }
+
+    icaltimezone *ical_tz = use_tz ? pg_rrule_get_session_timezone() : icaltimezone_get_utc_timezone();
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+    struct icaltimetype tt = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(ts), 0, ical_tz);
+
+    pg_rrule_match match = pg_rrule_match_fast(&tmp, dtstart, tt);
+    if (match != PG_RRULE_MATCH_UNKNOWN) {
+        PG_RETURN_BOOL(match == PG_RRULE_MATCH_YES);
+    }
+
+    // Anything the iterator produces inside [tt, tt] is tt itself
+    pg_rrule_iterator iter;
+    pg_rrule_iterator_init(&iter, tmp, dtstart, tt);
+    pg_rrule_iterator_seek(&iter, tt);
+
+    pg_time_t occurrence;
+    const bool found = pg_rrule_iterator_next(&iter, &occurrence);
+    pg_rrule_iterator_free(&iter);
+
+    PG_RETURN_BOOL(found);
+}
+
+Datum pg_rrule_occurs_at_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurs_at_common(fcinfo, true);
+}
+
+Datum pg_rrule_occurs_at(PG_FUNCTION_ARGS) {
+    return pg_rrule_occurs_at_common(fcinfo, false);
+}
+
+/* span */
+
+static Datum pg_rrule_span_common(FunctionCallInfo fcinfo, icaltimezone *ical_tz, Oid rangetypid) {
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+
+    TimestampTz dtstart_ts = PG_GETARG_TIMESTAMPTZ(1);
+
+    struct icaltimetype dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(dtstart_ts), 0, ical_tz);
+
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, rangetypid);
+
+    pg_time_t first, last;
+    bool bounded;
+    if (!pg_rrule_get_span(&tmp, dtstart, &first, &bounded, &last)) {
+        PG_RETURN_RANGE_P(make_empty_range(typcache));
+    }
+
+    RangeBound lower;
+    lower.val = TimestampTzGetDatum(time_t_to_timestamptz(first));
+    lower.infinite = false;
+    lower.inclusive = true;
+    lower.lower = true;
+
+    RangeBound upper;
+    upper.val = bounded ? TimestampTzGetDatum(time_t_to_timestamptz(last)) : (Datum) 0;
+    upper.infinite = !bounded;
+    upper.inclusive = bounded;
+    upper.lower = false;
+
+#if PG_VERSION_NUM >= 160000
+    PG_RETURN_RANGE_P(make_range(typcache, &lower, &upper, false, NULL));
+#else
+    PG_RETURN_RANGE_P(make_range(typcache, &lower, &upper, false));
+#endif
+}
+
+Datum pg_rrule_span_tz(PG_FUNCTION_ARGS) {
+    return pg_rrule_span_common(fcinfo, pg_rrule_get_session_timezone(), TSTZRANGEOID);
+}
+
+Datum pg_rrule_span_zone(PG_FUNCTION_ARGS) {
+    return pg_rrule_span_common(fcinfo, pg_rrule_get_named_timezone(PG_GETARG_TEXT_PP(2)), TSTZRANGEOID);
+}
+
+Datum pg_rrule_span(PG_FUNCTION_ARGS) {
+    return pg_rrule_span_common(fcinfo, icaltimezone_get_utc_timezone(), TSRANGEOID);
+}
+
+/* planner support */
+
+/* Cost units of cpu_operator_cost: decoding the rule and setting up the iterator, then each occurrence */
+#define PG_RRULE_COST_SETUP 100.0
+#define PG_RRULE_COST_PER_OCCURRENCE 2.0
+
+/* Most batch items looked at; the estimate of the others is extrapolated */
+#define PG_RRULE_SUPPORT_MAX_ITEMS 1000
+
+static bool pg_rrule_support_timestamp(PlannerInfo *root, Node *arg, TimestampTz *value) {
+    Node *node = root != NULL ? estimate_expression_value(root, arg) : arg;
+    if (!IsA(node, Const) || ((Const *) node)->constisnull) {
+        return false;
+    }
+    *value = DatumGetTimestampTz(((Const *) node)->constvalue);
+    return true;
+}
+
+static Const *pg_rrule_support_const(PlannerInfo *root, Node *arg) {
+    Node *node = root != NULL ? estimate_expression_value(root, arg) : arg;
+    if (!IsA(node, Const) || ((Const *) node)->constisnull) {
+        return NULL;
+    }
+    return (Const *) node;
+}
+
+static double pg_rrule_support_estimate_rule(Datum rule, TimestampTz lower, TimestampTz upper) {
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp((char *) pg_rrule_detoast(rule), &tmp);
+    return pg_rrule_estimate_occurrences(&tmp, lower, upper);
+}
+
+/* Estimated occurrences per call, from whatever arguments are constants */
+static bool pg_rrule_support_estimate(PlannerInfo *root, Node *node, double *occurrences) {
+    if (node == NULL || !IsA(node, FuncExpr)) {
+        return false;
+    }
+
+    List *args = ((FuncExpr *) node)->args;
+    Const *rules = pg_rrule_support_const(root, linitial(args));
+    if (rules == NULL) {
+        return false;
+    }
+
+    // The timestamps after the rule, up to the zone name if any: (dtstart), (dtstart, until) or
+    // (dtstart, window start, window end)
+    TimestampTz ts[3];
+    bool known[3];
+    int nts = 0;
+    for (int i = 1; i < list_length(args) && nts < 3; i++) {
+        Node *arg = list_nth(args, i);
+        if (exprType(arg) == TEXTOID) {
+            break;
+        }
+        known[nts] = pg_rrule_support_timestamp(root, arg, &ts[nts]);
+        nts++;
+    }
+
+    TimestampTz lower = DT_NOBEGIN;
+    TimestampTz upper = DT_NOEND;
+
+    if (OidIsValid(get_element_type(rules->consttype))) {
+        // rrule_occurrences_batch(rules, dtstarts, window start, window end)
+        if (nts != 3) {
+            return false;
+        }
+        if (known[1]) {
+            lower = ts[1];
+        }
+        if (known[2]) {
+            upper = ts[2];
+        }
+
+        Datum *items;
+        bool *nulls;
+        int nitems;
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        ArrayType *array = DatumGetArrayTypeP(rules->constvalue);
+        get_typlenbyvalalign(ARR_ELEMTYPE(array), &typlen, &typbyval, &typalign);
+        deconstruct_array(array, ARR_ELEMTYPE(array), typlen, typbyval, typalign, &items, &nulls, &nitems);
+
+        double total = 0;
+        int looked_at = 0;
+        for (int i = 0; i < nitems && looked_at < PG_RRULE_SUPPORT_MAX_ITEMS; i++) {
+            if (!nulls[i]) {
+                total += pg_rrule_support_estimate_rule(items[i], lower, upper);
+            }
+            looked_at++;
+        }
+        *occurrences = looked_at > 0 ? Max(total * nitems / looked_at, 1.0) : 1.0;
+        return true;
+    }
+
+    if (nts >= 1 && known[0]) {
+        lower = ts[0];
+    }
+    if (nts == 2 && known[1]) {
+        upper = ts[1];
+    } else if (nts == 3) {
+        if (known[1]) {
+            lower = Max(lower, ts[1]);
+        }
+        if (known[2]) {
+            upper = ts[2];
+        }
+    }
+
+    *occurrences = pg_rrule_support_estimate_rule(rules->constvalue, lower, upper);
+    return true;
+}
+
+Datum pg_rrule_occurrences_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    double occurrences;
+
+    if (IsA(rawreq, SupportRequestRows)) {
+        SupportRequestRows *req = (SupportRequestRows *) rawreq;
+        if (get_func_retset(req->funcid) && pg_rrule_support_estimate(req->root, req->node, &occurrences)) {
+            req->rows = occurrences;
+            PG_RETURN_POINTER(req);
+        }
+    } else if (IsA(rawreq, SupportRequestCost)) {
+        SupportRequestCost *req = (SupportRequestCost *) rawreq;
+        if (pg_rrule_support_estimate(req->root, req->node, &occurrences)) {
+            // Per call: whole arrays, and set-returning variants materialized by a function scan
+            req->startup = 0;
+            req->per_tuple = cpu_operator_cost * (PG_RRULE_COST_SETUP + PG_RRULE_COST_PER_OCCURRENCE * occurrences);
+            PG_RETURN_POINTER(req);
+        }
+    }
+
+    PG_RETURN_POINTER(NULL);
+}
+
+/* expanded form */
+Datum pg_rrule_expand(PG_FUNCTION_ARGS) {
+    // A read-write pointer is ours to return; anything else gets an object of its own
+    if (VARATT_IS_EXTERNAL_EXPANDED_RW(DatumGetPointer(PG_GETARG_DATUM(0)))) {
+        PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+    }
+    PG_RETURN_DATUM(pg_rrule_make_expanded(PG_GETARG_DATUM(0), CurrentMemoryContext));
+}
+
+/* expansion cache */
+Datum pg_rrule_cache_stats(PG_FUNCTION_ARGS) {
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        elog(ERROR, "return type must be a row type");
+    }
+
+    Datum values[4] = {
+        Int64GetDatum((int64) pg_rrule_cache_hits),
+        Int64GetDatum((int64) pg_rrule_cache_misses),
+        Int64GetDatum((int64) pg_rrule_cache_evictions),
+        Int64GetDatum((int64) pg_rrule_shared_cache_hits),
+    };
+    bool nulls[4] = {false, false, false, false};
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
+/* series */
+
+static int64 pg_rrule_series_duration_usecs(const Interval *duration) {
+    if (duration->month != 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("rrule_series duration must not contain months or years")));
+    }
+
+    const int64 usecs = duration->time + (int64) duration->day * USECS_PER_DAY;
+    if (usecs < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("rrule_series duration must not be negative")));
+    }
+    return usecs;
+}
+
+static pg_rrule_series *pg_rrule_series_build(const char *rule, Size rule_len, TimestampTz dtstart, int64 duration) {
+    if (TIMESTAMP_NOT_FINITE(dtstart)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("rrule_series DTSTART must be finite")));
+    }
+
+    pg_rrule_series *series = palloc(PG_RRULE_SERIES_HDRSZ + rule_len);
+    SET_VARSIZE(series, PG_RRULE_SERIES_HDRSZ + rule_len);
+    series->dtstart = dtstart;
+    series->duration = duration;
+    memcpy(series->rule, rule, rule_len);
+    return series;
+}
+
+/* The rule of a series as an rrule value */
+static struct varlena *pg_rrule_series_rule(const pg_rrule_series *series) {
+    const Size len = PG_RRULE_SERIES_RULE_LEN(series);
+    struct varlena *rule = palloc(VARHDRSZ + len);
+    SET_VARSIZE(rule, VARHDRSZ + len);
+    memcpy(VARDATA(rule), series->rule, len);
+    return rule;
+}
+
+/* Series are expanded in UTC */
+static void pg_rrule_series_decode(const pg_rrule_series *series, struct icalrecurrencetype *tmp, struct icaltimetype *dtstart) {
+    pg_rrule_decode(series->rule, PG_RRULE_SERIES_RULE_LEN(series), tmp);
+    *dtstart = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(series->dtstart), 0, icaltimezone_get_utc_timezone());
+}
+
+/* First occurrence and end of the last one, DT_NOEND if the series never ends; false if there is no occurrence */
+static bool pg_rrule_series_extent(const pg_rrule_series *series,
+                                   struct icalrecurrencetype *tmp,
+                                   struct icaltimetype *dtstart,
+                                   TimestampTz *lower,
+                                   TimestampTz *upper) {
+    pg_rrule_series_decode(series, tmp, dtstart);
+
+    pg_time_t first, last;
+    bool bounded;
+    if (!pg_rrule_get_span(tmp, *dtstart, &first, &bounded, &last)) {
+        return false;
+    }
+
+    *lower = time_t_to_timestamptz(first);
+    *upper = bounded ? time_t_to_timestamptz(last) + series->duration : DT_NOEND;
+    return true;
+}
+
+static void pg_rrule_series_leaf_key(const pg_rrule_series *series, pg_rrule_series_key *key) {
+    struct icalrecurrencetype tmp;
+    struct icaltimetype dtstart;
+
+    memset(key, 0, sizeof(pg_rrule_series_key));
+    if (!pg_rrule_series_extent(series, &tmp, &dtstart, &key->lower, &key->upper)) {
+        key->empty = true;
+        return;
+    }
+
+    pg_rrule_compiled compiled;
+    int64 period, phase, width;
+    if (pg_rrule_compile(&tmp, dtstart, &compiled) && pg_rrule_compiled_period(&compiled, &period, &phase, &width)) {
+        pg_rrule_series_key_set_period(key, period, phase, width, series->duration);
+    }
+}
+
+Datum pg_rrule_series_in(PG_FUNCTION_ARGS) {
+    const char *const input = PG_GETARG_CSTRING(0);
+    char *str = pstrdup(input);
+
+    char *separator = strchr(str, ';');
+    if (strncmp(str, "DTSTART=", 8) != 0 || separator == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid input syntax for type %s: \"%s\"", "rrule_series", input),
+                 errhint("Expected \"DTSTART=<timestamp>;DURATION=<interval>;<rule>\", DURATION being optional.")));
+    }
+
+    *separator = '\0';
+    const TimestampTz dtstart = DatumGetTimestampTz(DirectFunctionCall3(timestamptz_in,
+                                                                        CStringGetDatum(str + 8),
+                                                                        ObjectIdGetDatum(InvalidOid),
+                                                                        Int32GetDatum(-1)));
+    char *part = separator + 1;
+
+    int64 duration = 0;
+    if (strncmp(part, "DURATION=", 9) == 0) {
+        separator = strchr(part, ';');
+        if (separator == NULL) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                     errmsg("invalid input syntax for type %s: \"%s\"", "rrule_series", input),
+                     errhint("Expected \"DTSTART=<timestamp>;DURATION=<interval>;<rule>\", DURATION being optional.")));
+        }
+
+        *separator = '\0';
+        duration = pg_rrule_series_duration_usecs(DatumGetIntervalP(DirectFunctionCall3(interval_in,
+                                                                                        CStringGetDatum(part + 9),
+                                                                                        ObjectIdGetDatum(InvalidOid),
+                                                                                        Int32GetDatum(-1))));
+        part = separator + 1;
+    }
+
+    struct varlena *rule = (struct varlena *) DatumGetPointer(DirectFunctionCall1(pg_rrule_in, CStringGetDatum(part)));
+    PG_RETURN_POINTER(pg_rrule_series_build(VARDATA(rule), VARSIZE(rule) - VARHDRSZ, dtstart, duration));
+}
+
+Datum pg_rrule_series_out(PG_FUNCTION_ARGS) {
+    const pg_rrule_series *series = PG_GETARG_RRULE_SERIES_P(0);
+
+    StringInfoData buf;
+    initStringInfo(&buf);
+
+    appendStringInfo(&buf, "DTSTART=%s;", DatumGetCString(DirectFunctionCall1(timestamptz_out, TimestampTzGetDatum(series->dtstart))));
+
+    if (series->duration != 0) {
+        Interval duration;
+        duration.month = 0;
+        duration.day = (int32) (series->duration / USECS_PER_DAY);
+        duration.time = series->duration % USECS_PER_DAY;
+        appendStringInfo(&buf, "DURATION=%s;", DatumGetCString(DirectFunctionCall1(interval_out, IntervalPGetDatum(&duration))));
+    }
+
+    appendStringInfoString(&buf, DatumGetCString(DirectFunctionCall1(pg_rrule_out, PointerGetDatum(pg_rrule_series_rule(series)))));
+
+    PG_RETURN_CSTRING(buf.data);
+}
+
+Datum pg_rrule_series_send(PG_FUNCTION_ARGS) {
+    const pg_rrule_series *series = PG_GETARG_RRULE_SERIES_P(0);
+
+    StringInfoData buf;
+    pq_begintypsend(&buf);
+
+    pq_sendint64(&buf, series->dtstart);
+    pq_sendint64(&buf, series->duration);
+    pq_sendbytes(&buf, series->rule, (int) PG_RRULE_SERIES_RULE_LEN(series));
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum pg_rrule_series_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+
+    const TimestampTz dtstart = pq_getmsgint64(buf);
+    const int64 duration = pq_getmsgint64(buf);
+    if (duration < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("rrule_series duration must not be negative")));
+    }
+
+    // Validates the rule and makes it canonical, as pg_rrule_recv() does
+    const int len = buf->len - buf->cursor;
+    const char *data = pq_getmsgbytes(buf, len);
+    if (pg_rrule_is_legacy(data, (Size) len)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid rrule in binary rrule_series value")));
+    }
+
+    struct icalrecurrencetype tmp;
+    pg_rrule_decode(data, (Size) len, &tmp);
+    struct varlena *rule = pg_rrule_encode(&tmp);
+
+    PG_RETURN_POINTER(pg_rrule_series_build(VARDATA(rule), VARSIZE(rule) - VARHDRSZ, dtstart, duration));
+}
+
+Datum pg_rrule_series_make(PG_FUNCTION_ARGS) {
+    Size len;
+    const char *rule = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &len);
+    const int64 duration = pg_rrule_series_duration_usecs(PG_GETARG_INTERVAL_P(2));
+
+    PG_RETURN_POINTER(pg_rrule_series_build(rule, len, PG_GETARG_TIMESTAMPTZ(1), duration));
+}
+
+Datum pg_rrule_series_get_rule(PG_FUNCTION_ARGS) {
+    PG_RETURN_POINTER(pg_rrule_series_rule(PG_GETARG_RRULE_SERIES_P(0)));
+}
+
+Datum pg_rrule_series_get_dtstart(PG_FUNCTION_ARGS) {
+    PG_RETURN_TIMESTAMPTZ(PG_GETARG_RRULE_SERIES_P(0)->dtstart);
+}
+
+Datum pg_rrule_series_get_duration(PG_FUNCTION_ARGS) {
+    const pg_rrule_series *series = PG_GETARG_RRULE_SERIES_P(0);
+
+    Interval *duration = palloc(sizeof(Interval));
+    duration->month = 0;
+    duration->day = (int32) (series->duration / USECS_PER_DAY);
+    duration->time = series->duration % USECS_PER_DAY;
+
+    PG_RETURN_INTERVAL_P(duration);
+}
+
+Datum pg_rrule_series_overlaps(PG_FUNCTION_ARGS) {
+    const pg_rrule_series *series = PG_GETARG_RRULE_SERIES_P(0);
+    RangeType *range = PG_GETARG_RANGE_P(1);
+
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(range));
+    RangeBound lower, upper;
+    bool empty;
+    range_deserialize(typcache, range, &lower, &upper, &empty);
+    if (empty) {
+        PG_RETURN_BOOL(false);
+    }
+
+    struct icalrecurrencetype tmp;
+    struct icaltimetype dtstart;
+    pg_rrule_series_decode(series, &tmp, &dtstart);
+
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+    const TimestampTz lower_ts = lower.infinite ? DT_NOBEGIN : DatumGetTimestampTz(lower.val);
+    const TimestampTz upper_ts = upper.infinite ? DT_NOEND : DatumGetTimestampTz(upper.val);
+
+    // Occurrences fall on whole seconds, so the second holding upper_ts is the last one to look at
+    struct icaltimetype until = icaltime_null_time();
+    if (!upper.infinite) {
+        until = icaltime_from_timet_with_zone((time_t) timestamptz_to_time_t(upper_ts), 0, utc);
+    }
+
+    // Must agree with the index keys, which ignore pg_rrule.max_occurrences too
+    pg_rrule_iterator iter;
+    pg_rrule_iterator_init(&iter, tmp, dtstart, until);
+    iter.unlimited = true;
+
+    // Occurrences starting more than one duration before the range can't reach into it
+    if (!lower.infinite) {
+        const pg_time_t from = timestamptz_to_time_t(lower_ts - series->duration) - 1;
+        pg_rrule_iterator_seek(&iter, icaltime_from_timet_with_zone((time_t) from, 0, utc));
+    }
+
+    bool found = false;
+    pg_time_t occurrence;
+    while (pg_rrule_iterator_next(&iter, &occurrence)) {
+        const TimestampTz start = time_t_to_timestamptz(occurrence);
+
+        if (!lower.infinite) {
+            const bool reaches = series->duration > 0 ? start + series->duration > lower_ts
+                                                      : start > lower_ts || (start == lower_ts && lower.inclusive);
+            if (!reaches) {
+                continue;
+            }
+        }
+
+        found = upper.infinite || start < upper_ts || (start == upper_ts && upper.inclusive);
+        break;
+    }
+
+    pg_rrule_iterator_free(&iter);
+    PG_RETURN_BOOL(found);
+}
+
+Datum pg_rrule_series_key_in(PG_FUNCTION_ARGS) {
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("rrule_series_key is only used inside GiST indexes")));
+    PG_RETURN_VOID();
+}
+
+Datum pg_rrule_series_key_out(PG_FUNCTION_ARGS) {
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("rrule_series_key is only used inside GiST indexes")));
+    PG_RETURN_VOID();
+}
+
+Datum pg_rrule_series_gist_consistent(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    RangeType *range = PG_GETARG_RANGE_P(1);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+
+    // Keys only bound where occurrences can be, the operator decides
+    *recheck = true;
+
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(range));
+    RangeBound lower, upper;
+    bool empty;
+    range_deserialize(typcache, range, &lower, &upper, &empty);
+    if (empty) {
+        PG_RETURN_BOOL(false);
+    }
+
+    const pg_rrule_series_key *key = (const pg_rrule_series_key *) DatumGetPointer(entry->key);
+    PG_RETURN_BOOL(pg_rrule_series_key_overlaps(key,
+                                                lower.infinite ? DT_NOBEGIN : DatumGetTimestampTz(lower.val),
+                                                upper.infinite ? DT_NOEND : DatumGetTimestampTz(upper.val)));
+}
+
+Datum pg_rrule_series_gist_union(PG_FUNCTION_ARGS) {
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    int *size = (int *) PG_GETARG_POINTER(1);
+
+    pg_rrule_series_key *result = palloc(sizeof(pg_rrule_series_key));
+    *result = *(const pg_rrule_series_key *) DatumGetPointer(entryvec->vector[0].key);
+    for (int i = 1; i < entryvec->n; i++) {
+        pg_rrule_series_key_union(result, (const pg_rrule_series_key *) DatumGetPointer(entryvec->vector[i].key));
+    }
+
+    *size = sizeof(pg_rrule_series_key);
+    PG_RETURN_POINTER(result);
+}
+
+Datum pg_rrule_series_gist_compress(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+
+    if (!entry->leafkey) {
+        PG_RETURN_POINTER(entry);
+    }
+
+    pg_rrule_series_key *key = palloc(sizeof(pg_rrule_series_key));
+    pg_rrule_series_leaf_key((const pg_rrule_series *) PG_DETOAST_DATUM(entry->key), key);
+
+    GISTENTRY *result = palloc(sizeof(GISTENTRY));
+    gistentryinit(*result, PointerGetDatum(key), entry->rel, entry->page, entry->offset, false);
+    PG_RETURN_POINTER(result);
+}
+
+Datum pg_rrule_series_gist_penalty(PG_FUNCTION_ARGS) {
+    GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+    float *penalty = (float *) PG_GETARG_POINTER(2);
+
+    *penalty = pg_rrule_series_key_penalty((const pg_rrule_series_key *) DatumGetPointer(origentry->key),
+                                           (const pg_rrule_series_key *) DatumGetPointer(newentry->key));
+    PG_RETURN_POINTER(penalty);
+}
+
+typedef struct pg_rrule_series_split_item {
+    OffsetNumber offset;
+    const pg_rrule_series_key *key;
+} pg_rrule_series_split_item;
+
+static int pg_rrule_series_split_cmp(const void *a, const void *b) {
+    const pg_rrule_series_key *key_a = ((const pg_rrule_series_split_item *) a)->key;
+    const pg_rrule_series_key *key_b = ((const pg_rrule_series_split_item *) b)->key;
+
+    if (key_a->empty != key_b->empty) {
+        return key_a->empty ? -1 : 1;
+    }
+    if (key_a->lower != key_b->lower) {
+        return key_a->lower < key_b->lower ? -1 : 1;
+    }
+    if (key_a->upper != key_b->upper) {
+        return key_a->upper < key_b->upper ? -1 : 1;
+    }
+    return 0;
+}
+
+Datum pg_rrule_series_gist_picksplit(PG_FUNCTION_ARGS) {
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+
+    // Sort by extent and cut in the middle, which keeps series active in the same years together
+    const OffsetNumber maxoff = (OffsetNumber) (entryvec->n - 1);
+    const int nitems = maxoff - FirstOffsetNumber + 1;
+    pg_rrule_series_split_item *items = palloc(nitems * sizeof(pg_rrule_series_split_item));
+    for (OffsetNumber i = FirstOffsetNumber; i <= maxoff; i = OffsetNumberNext(i)) {
+        items[i - FirstOffsetNumber].offset = i;
+        items[i - FirstOffsetNumber].key = (const pg_rrule_series_key *) DatumGetPointer(entryvec->vector[i].key);
+    }
+    qsort(items, nitems, sizeof(pg_rrule_series_split_item), pg_rrule_series_split_cmp);
+
+    v->spl_left = palloc(nitems * sizeof(OffsetNumber));
+    v->spl_right = palloc(nitems * sizeof(OffsetNumber));
+    v->spl_nleft = 0;
+    v->spl_nright = 0;
+
+    pg_rrule_series_key *left = palloc(sizeof(pg_rrule_series_key));
+    pg_rrule_series_key *right = palloc(sizeof(pg_rrule_series_key));
+    *left = *items[0].key;
+    *right = *items[nitems / 2].key;
+
+    for (int i = 0; i < nitems; i++) {
+        if (i < nitems / 2) {
+            pg_rrule_series_key_union(left, items[i].key);
+            v->spl_left[v->spl_nleft++] = items[i].offset;
+        } else {
+            pg_rrule_series_key_union(right, items[i].key);
+            v->spl_right[v->spl_nright++] = items[i].offset;
+        }
+    }
+
+    v->spl_ldatum = PointerGetDatum(left);
+    v->spl_rdatum = PointerGetDatum(right);
+    PG_RETURN_POINTER(v);
+}
+
+Datum pg_rrule_series_gist_same(PG_FUNCTION_ARGS) {
+    const pg_rrule_series_key *a = (const pg_rrule_series_key *) PG_GETARG_POINTER(0);
+    const pg_rrule_series_key *b = (const pg_rrule_series_key *) PG_GETARG_POINTER(1);
+    bool *result = (bool *) PG_GETARG_POINTER(2);
+
+    *result = a->empty == b->empty && a->lower == b->lower && a->upper == b->upper &&
+              a->period == b->period && (a->period == 0 || (a->phase == b->phase && a->width == b->width));
+    PG_RETURN_POINTER(result);
+}
+
+/* BRIN */
+
+/* Index of the summary values in BrinValues */
+#define PG_RRULE_BRIN_LOWER 0
+#define PG_RRULE_BRIN_UPPER 1
+
+Datum pg_rrule_series_brin_opcinfo(PG_FUNCTION_ARGS) {
+    BrinOpcInfo *result = palloc0(MAXALIGN(SizeofBrinOpcInfo(2)));
+
+    result->oi_nstored = 2;
+#if PG_VERSION_NUM >= 140000
+    result->oi_regular_nulls = true;
+#endif
+    result->oi_typcache[PG_RRULE_BRIN_LOWER] = lookup_type_cache(TIMESTAMPTZOID, 0);
+    result->oi_typcache[PG_RRULE_BRIN_UPPER] = lookup_type_cache(TIMESTAMPTZOID, 0);
+
+    PG_RETURN_POINTER(result);
+}
+
+static void pg_rrule_series_brin_set(BrinDesc *bdesc, BrinValues *column, int n, TimestampTz value) {
+    const TypeCacheEntry *typcache = bdesc->bd_info[column->bv_attno - 1]->oi_typcache[n];
+
+    if (!typcache->typbyval && !column->bv_allnulls) {
+        pfree(DatumGetPointer(column->bv_values[n]));
+    }
+    column->bv_values[n] = datumCopy(TimestampTzGetDatum(value), typcache->typbyval, typcache->typlen);
+}
+
+Datum pg_rrule_series_brin_add_value(PG_FUNCTION_ARGS) {
+    BrinDesc *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    const Datum newval = PG_GETARG_DATUM(2);
+    const bool isnull = PG_GETARG_BOOL(3);
+
+    // Only reached for NULLs before PostgreSQL 14
+    if (isnull) {
+        if (column->bv_hasnulls) {
+            PG_RETURN_BOOL(false);
+        }
+        column->bv_hasnulls = true;
+        PG_RETURN_BOOL(true);
+    }
+
+    struct icalrecurrencetype tmp;
+    struct icaltimetype dtstart;
+    TimestampTz lower, upper;
+    const bool has_occurrences = pg_rrule_series_extent((const pg_rrule_series *) PG_DETOAST_DATUM(newval),
+                                                        &tmp, &dtstart, &lower, &upper);
+
+    // A range holding only series without occurrences gets an inverted extent, which nothing overlaps
+    if (column->bv_allnulls) {
+        pg_rrule_series_brin_set(bdesc, column, PG_RRULE_BRIN_LOWER, has_occurrences ? lower : DT_NOEND);
+        pg_rrule_series_brin_set(bdesc, column, PG_RRULE_BRIN_UPPER, has_occurrences ? upper : DT_NOBEGIN);
+        column->bv_allnulls = false;
+        PG_RETURN_BOOL(true);
+    }
+
+    if (!has_occurrences) {
+        PG_RETURN_BOOL(false);
+    }
+
+    bool updated = false;
+    if (lower < DatumGetTimestampTz(column->bv_values[PG_RRULE_BRIN_LOWER])) {
+        pg_rrule_series_brin_set(bdesc, column, PG_RRULE_BRIN_LOWER, lower);
+        updated = true;
+    }
+    if (upper > DatumGetTimestampTz(column->bv_values[PG_RRULE_BRIN_UPPER])) {
+        pg_rrule_series_brin_set(bdesc, column, PG_RRULE_BRIN_UPPER, upper);
+        updated = true;
+    }
+
+    PG_RETURN_BOOL(updated);
+}
+
+Datum pg_rrule_series_brin_consistent(PG_FUNCTION_ARGS) {
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    ScanKey key = (ScanKey) PG_GETARG_POINTER(2);
+
+    // Only reached for IS [NOT] NULL keys before PostgreSQL 14
+    if (key->sk_flags & SK_ISNULL) {
+        if (key->sk_flags & SK_SEARCHNULL) {
+            PG_RETURN_BOOL(column->bv_allnulls || column->bv_hasnulls);
+        }
+        if (key->sk_flags & SK_SEARCHNOTNULL) {
+            PG_RETURN_BOOL(!column->bv_allnulls);
+        }
+        PG_RETURN_BOOL(false);
+    }
+
+    if (column->bv_allnulls) {
+        PG_RETURN_BOOL(false);
+    }
+
+    RangeType *range = DatumGetRangeTypeP(key->sk_argument);
+    TypeCacheEntry *typcache = range_get_typcache(fcinfo, RangeTypeGetOid(range));
+    RangeBound lower, upper;
+    bool empty;
+    range_deserialize(typcache, range, &lower, &upper, &empty);
+    if (empty) {
+        PG_RETURN_BOOL(false);
+    }
+
+    PG_RETURN_BOOL((upper.infinite || DatumGetTimestampTz(upper.val) >= DatumGetTimestampTz(column->bv_values[PG_RRULE_BRIN_LOWER])) &&
+                   (lower.infinite || DatumGetTimestampTz(lower.val) <= DatumGetTimestampTz(column->bv_values[PG_RRULE_BRIN_UPPER])));
+}
+
+Datum pg_rrule_series_brin_union(PG_FUNCTION_ARGS) {
+    BrinDesc *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+    BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+    BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+
+    col_a->bv_hasnulls |= col_b->bv_hasnulls;
+    if (col_b->bv_allnulls) {
+        PG_RETURN_VOID();
+    }
+
+    const TimestampTz lower_b = DatumGetTimestampTz(col_b->bv_values[PG_RRULE_BRIN_LOWER]);
+    const TimestampTz upper_b = DatumGetTimestampTz(col_b->bv_values[PG_RRULE_BRIN_UPPER]);
+
+    if (col_a->bv_allnulls) {
+        pg_rrule_series_brin_set(bdesc, col_a, PG_RRULE_BRIN_LOWER, lower_b);
+        pg_rrule_series_brin_set(bdesc, col_a, PG_RRULE_BRIN_UPPER, upper_b);
+        col_a->bv_allnulls = false;
+        PG_RETURN_VOID();
+    }
+
+    if (lower_b < DatumGetTimestampTz(col_a->bv_values[PG_RRULE_BRIN_LOWER])) {
+        pg_rrule_series_brin_set(bdesc, col_a, PG_RRULE_BRIN_LOWER, lower_b);
+    }
+    if (upper_b > DatumGetTimestampTz(col_a->bv_values[PG_RRULE_BRIN_UPPER])) {
+        pg_rrule_series_brin_set(bdesc, col_a, PG_RRULE_BRIN_UPPER, upper_b);
+    }
+
+    PG_RETURN_VOID();
+}
+
+/* statistics */
+
+/*
+ * Slot kind of the statistics ANALYZE adds to rrule and rrule_series
+ * columns, from the range pg_statistic.h leaves for private use. Its
+ * stanumbers hold the values at the offsets below; only series have the
+ * ones from PG_RRULE_STATS_LOWER on. Quantiles are evenly spaced, from the
+ * minimum to the maximum.
+ */
+#define PG_RRULE_STATISTIC_KIND 10731
+
+#define PG_RRULE_STATS_QUANTILES 11
+#define PG_RRULE_STATS_FREQ 0               /* fraction of each FREQ, SECONDLY to YEARLY */
+#define PG_RRULE_STATS_BOUNDED 7            /* fraction with COUNT or UNTIL */
+#define PG_RRULE_STATS_INTERVAL 8           /* mean INTERVAL */
+#define PG_RRULE_STATS_RATE 9               /* quantiles of occurrences per day */
+#define PG_RRULE_STATS_RULE_NUMBERS 20
+#define PG_RRULE_STATS_NONEMPTY 20          /* fraction of series with occurrences; the rest describes those */
+#define PG_RRULE_STATS_LOWER 21             /* quantiles of the first occurrence, in days since 2000-01-01 */
+#define PG_RRULE_STATS_UPPER 32             /* quantiles of the end of the last one, Infinity if there is none */
+#define PG_RRULE_STATS_DURATION 43          /* mean DURATION, in days */
+#define PG_RRULE_STATS_SERIES_NUMBERS 44
+
+/* Selectivity of && without statistics, as contsel */
+#define PG_RRULE_DEFAULT_OVERLAP_SEL 0.001
+
+/* Ranges longer than this many days are taken as unbounded */
+#define PG_RRULE_STATS_MAX_DAYS 1.0e6
+
+typedef struct pg_rrule_analyze_extra {
+    AnalyzeAttrComputeStatsFunc std_compute_stats;
+    void *std_extra_data;
+    bool series;
+} pg_rrule_analyze_extra;
+
+static int pg_rrule_stats_cmp(const void *a, const void *b) {
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void pg_rrule_stats_quantiles(double *values, int n, float4 *quantiles) {
+    qsort(values, n, sizeof(double), pg_rrule_stats_cmp);
+    for (int i = 0; i < PG_RRULE_STATS_QUANTILES; i++) {
+        quantiles[i] = (float4) values[(int64) i * (n - 1) / (PG_RRULE_STATS_QUANTILES - 1)];
+    }
+}
+
+/* Fraction of the values not above x, interpolated between quantiles */
+static double pg_rrule_stats_fraction_below(const float4 *quantiles, double x) {
+    const int last = PG_RRULE_STATS_QUANTILES - 1;
+    if (x < quantiles[0]) {
+        return 0.0;
+    }
+    if (x >= quantiles[last]) {
+        return 1.0;
+    }
+
+    int i = 0;
+    while (x >= quantiles[i + 1]) {
+        i++;
+    }
+    // Nothing to interpolate towards an Infinity
+    const double width = (double) quantiles[i + 1] - quantiles[i];
+    const double within = isinf(width) || !(width > 0) ? 0.0 : (x - quantiles[i]) / width;
+    return (i + within) / last;
+}
+
+/* Mean of min(1, value * scale) over the values, from their quantiles */
+static double pg_rrule_stats_mean_probability(const float4 *quantiles, double scale) {
+    const int last = PG_RRULE_STATS_QUANTILES - 1;
+    double sum = 0;
+    for (int i = 0; i < last; i++) {
+        sum += (Min(1.0, quantiles[i] * scale) + Min(1.0, quantiles[i + 1] * scale)) / 2;
+    }
+    return sum / last;
+}
+
+static void pg_rrule_compute_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc, int samplerows, double totalrows) {
+    pg_rrule_analyze_extra *extra = (pg_rrule_analyze_extra *) stats->extra_data;
+
+    // Null fraction, width and whatever else the standard statistics hold come first
+    stats->extra_data = extra->std_extra_data;
+    extra->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+    stats->extra_data = extra;
+
+    int slot = 0;
+    while (slot < STATISTIC_NUM_SLOTS && stats->stakind[slot] != 0) {
+        slot++;
+    }
+    if (slot == STATISTIC_NUM_SLOTS) {
+        return;
+    }
+
+    double freqs[ICAL_YEARLY_RECURRENCE + 1] = {0};
+    double bounded = 0;
+    double interval_sum = 0;
+    double duration_sum = 0;
+    double *rates = palloc(sizeof(double) * samplerows);
+    double *lowers = extra->series ? palloc(sizeof(double) * samplerows) : NULL;
+    double *uppers = extra->series ? palloc(sizeof(double) * samplerows) : NULL;
+    int nrules = 0;
+    int nseries = 0;
+
+    MemoryContext row_context = AllocSetContextCreate(CurrentMemoryContext, "pg_rrule analyze", ALLOCSET_DEFAULT_SIZES);
+
+    for (int i = 0; i < samplerows; i++) {
+#if PG_VERSION_NUM >= 180000
+        vacuum_delay_point(true);
+#else
+        vacuum_delay_point();
+#endif
+
+        bool isnull;
+        const Datum value = fetchfunc(stats, i, &isnull);
+        if (isnull) {
+            continue;
+        }
+
+        MemoryContext old_context = MemoryContextSwitchTo(row_context);
+        struct icalrecurrencetype tmp;
+
+        if (extra->series) {
+            const pg_rrule_series *series = (const pg_rrule_series *) PG_DETOAST_DATUM(value);
+            struct icaltimetype dtstart;
+            TimestampTz lower, upper;
+            if (pg_rrule_series_extent(series, &tmp, &dtstart, &lower, &upper)) {
+                lowers[nseries] = (double) lower / USECS_PER_DAY;
+                uppers[nseries] = upper == DT_NOEND ? get_float8_infinity() : (double) upper / USECS_PER_DAY;
+                duration_sum += (double) series->duration / USECS_PER_DAY;
+                nseries++;
+            }
+        } else {
+            flatten_to_tmp((char *) pg_rrule_detoast(value), &tmp);
+        }
+
+        if (tmp.freq >= ICAL_SECONDLY_RECURRENCE && tmp.freq <= ICAL_YEARLY_RECURRENCE) {
+            freqs[tmp.freq]++;
+        }
+        if (tmp.count > 0 || !icaltime_is_null_time(tmp.until)) {
+            bounded++;
+        }
+        interval_sum += tmp.interval > 0 ? tmp.interval : 1;
+        rates[nrules++] = pg_rrule_estimate_rate(&tmp) * SECS_PER_DAY;
+
+        MemoryContextSwitchTo(old_context);
+        MemoryContextReset(row_context);
+    }
+
+    MemoryContextDelete(row_context);
+
+    if (nrules == 0) {
+        return;
+    }
+
+    const int nnumbers = extra->series ? PG_RRULE_STATS_SERIES_NUMBERS : PG_RRULE_STATS_RULE_NUMBERS;
+    float4 *numbers = MemoryContextAllocZero(stats->anl_context, sizeof(float4) * nnumbers);
+
+    for (int freq = ICAL_SECONDLY_RECURRENCE; freq <= ICAL_YEARLY_RECURRENCE; freq++) {
+        numbers[PG_RRULE_STATS_FREQ + freq] = (float4) (freqs[freq] / nrules);
+    }
+    numbers[PG_RRULE_STATS_BOUNDED] = (float4) (bounded / nrules);
+    numbers[PG_RRULE_STATS_INTERVAL] = (float4) (interval_sum / nrules);
+    pg_rrule_stats_quantiles(rates, nrules, numbers + PG_RRULE_STATS_RATE);
+
+    if (extra->series) {
+        numbers[PG_RRULE_STATS_NONEMPTY] = (float4) ((double) nseries / nrules);
+        if (nseries > 0) {
+            pg_rrule_stats_quantiles(lowers, nseries, numbers + PG_RRULE_STATS_LOWER);
+            pg_rrule_stats_quantiles(uppers, nseries, numbers + PG_RRULE_STATS_UPPER);
+            numbers[PG_RRULE_STATS_DURATION] = (float4) (duration_sum / nseries);
+        }
+    }
+
+    stats->stakind[slot] = PG_RRULE_STATISTIC_KIND;
+    stats->staop[slot] = InvalidOid;
+    stats->stanumbers[slot] = numbers;
+    stats->numnumbers[slot] = nnumbers;
+}
+
+static bool pg_rrule_typanalyze_common(VacAttrStats *stats, bool series) {
+    if (!std_typanalyze(stats)) {
+        return false;
+    }
+
+    pg_rrule_analyze_extra *extra = palloc(sizeof(pg_rrule_analyze_extra));
+    extra->std_compute_stats = stats->compute_stats;
+    extra->std_extra_data = stats->extra_data;
+    extra->series = series;
+
+    stats->compute_stats = pg_rrule_compute_stats;
+    stats->extra_data = extra;
+    return true;
+}
+
+Datum pg_rrule_typanalyze(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_typanalyze_common((VacAttrStats *) PG_GETARG_POINTER(0), false));
+}
+
+Datum pg_rrule_series_typanalyze(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_typanalyze_common((VacAttrStats *) PG_GETARG_POINTER(0), true));
+}
+
+/* The slot of PG_RRULE_STATISTIC_KIND of a variable and its null fraction; false if it has none */
+static bool pg_rrule_stats_get(VariableStatData *vardata, int nnumbers, AttStatsSlot *sslot, double *nullfrac) {
+    if (!HeapTupleIsValid(vardata->statsTuple) ||
+        !get_attstatsslot(sslot, vardata->statsTuple, PG_RRULE_STATISTIC_KIND, InvalidOid, ATTSTATSSLOT_NUMBERS)) {
+        return false;
+    }
+    if (sslot->nnumbers < nnumbers) {
+        free_attstatsslot(sslot);
+        return false;
+    }
+
+    *nullfrac = ((Form_pg_statistic) GETSTRUCT(vardata->statsTuple))->stanullfrac;
+    return true;
+}
+
+/* A range bound in days since 2000-01-01, infinite bounds as +/-Infinity */
+static double pg_rrule_stats_bound_days(const RangeBound *bound) {
+    if (bound->infinite) {
+        return bound->lower ? -get_float8_infinity() : get_float8_infinity();
+    }
+
+    const TimestampTz value = DatumGetTimestampTz(bound->val);
+    if (TIMESTAMP_IS_NOBEGIN(value)) {
+        return -get_float8_infinity();
+    }
+    if (TIMESTAMP_IS_NOEND(value)) {
+        return get_float8_infinity();
+    }
+    return (double) value / USECS_PER_DAY;
+}
+
+static Selectivity pg_rrule_series_overlap_estimate(VariableStatData *vardata, RangeType *range) {
+    AttStatsSlot sslot;
+    double nullfrac;
+    if (!pg_rrule_stats_get(vardata, PG_RRULE_STATS_SERIES_NUMBERS, &sslot, &nullfrac)) {
+        return PG_RRULE_DEFAULT_OVERLAP_SEL;
+    }
+
+    TypeCacheEntry *typcache = lookup_type_cache(RangeTypeGetOid(range), TYPECACHE_RANGE_INFO);
+    RangeBound lower, upper;
+    bool empty;
+    range_deserialize(typcache, range, &lower, &upper, &empty);
+    if (empty) {
+        free_attstatsslot(&sslot);
+        return 0.0;
+    }
+
+    const float4 *numbers = sslot.numbers;
+    const double lo = pg_rrule_stats_bound_days(&lower);
+    const double hi = pg_rrule_stats_bound_days(&upper);
+
+    // Series that have begun by the end of the range and not ended before its start
+    const double started = pg_rrule_stats_fraction_below(numbers + PG_RRULE_STATS_LOWER, hi);
+    const double ended = pg_rrule_stats_fraction_below(numbers + PG_RRULE_STATS_UPPER, lo);
+    const double active = numbers[PG_RRULE_STATS_NONEMPTY] * started * (1.0 - ended);
+
+    // Occurrences touching the range start within it or up to one DURATION (at least a second) before
+    const double length = Min(hi - lo, PG_RRULE_STATS_MAX_DAYS);
+    const double reach = length + numbers[PG_RRULE_STATS_DURATION] + 1.0 / SECS_PER_DAY;
+    const double hit = pg_rrule_stats_mean_probability(numbers + PG_RRULE_STATS_RATE, reach);
+
+    free_attstatsslot(&sslot);
+
+    Selectivity selectivity = (1.0 - nullfrac) * active * hit;
+    CLAMP_PROBABILITY(selectivity);
+    return selectivity;
+}
+
+Datum pg_rrule_series_overlap_sel(PG_FUNCTION_ARGS) {
+    PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+    List *args = (List *) PG_GETARG_POINTER(2);
+    const int varRelid = PG_GETARG_INT32(3);
+
+    VariableStatData vardata;
+    Node *other;
+    bool varonleft;
+    if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft)) {
+        PG_RETURN_FLOAT8(PG_RRULE_DEFAULT_OVERLAP_SEL);
+    }
+
+    Selectivity selectivity = PG_RRULE_DEFAULT_OVERLAP_SEL;
+    if (varonleft && IsA(other, Const)) {
+        const Const *range = (const Const *) other;
+        // The operator is strict
+        selectivity = range->constisnull ? 0.0
+                                         : pg_rrule_series_overlap_estimate(&vardata, DatumGetRangeTypeP(range->constvalue));
+    }
+
+    ReleaseVariableStats(vardata);
+    PG_RETURN_FLOAT8(selectivity);
+}
+
+Datum pg_rrule_occurs_at_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    if (!IsA(rawreq, SupportRequestSelectivity)) {
+        PG_RETURN_POINTER(NULL);
+    }
+
+    SupportRequestSelectivity *req = (SupportRequestSelectivity *) rawreq;
+    if (req->is_join) {
+        PG_RETURN_POINTER(NULL);
     }
 
-    // Compare UNTIL
-    if (icaltime_compare(tmp1.until, tmp2.until) != 0) {
-        PG_RETURN_BOOL(false);
+    VariableStatData vardata;
+    examine_variable(req->root, linitial(req->args), req->varRelid, &vardata);
+
+    AttStatsSlot sslot;
+    double nullfrac;
+    const bool found = pg_rrule_stats_get(&vardata, PG_RRULE_STATS_RULE_NUMBERS, &sslot, &nullfrac);
+    if (found) {
+        // Occurrences fall on whole seconds; the chance of one at a given second is the rate per second
+        req->selectivity = (1.0 - nullfrac) *
+                           pg_rrule_stats_mean_probability(sslot.numbers + PG_RRULE_STATS_RATE, 1.0 / SECS_PER_DAY);
+        CLAMP_PROBABILITY(req->selectivity);
+        free_attstatsslot(&sslot);
     }
 
-    // Compare RSCALE
-    if ((tmp1.rscale == NULL && tmp2.rscale != NULL) ||
-        (tmp1.rscale != NULL && tmp2.rscale == NULL) ||
-        (tmp1.rscale != NULL && tmp2.rscale != NULL &&
-         strcmp(tmp1.rscale, tmp2.rscale) != 0)) {
-        PG_RETURN_BOOL(false);
+    ReleaseVariableStats(vardata);
+    PG_RETURN_POINTER(found ? req : NULL);
+}
+
+/* operators */
+static int pg_rrule_compare(FunctionCallInfo fcinfo) {
+    Size len1, len2;
+    const char *data1 = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &len1);
+    const char *data2 = pg_rrule_canonical(PG_GETARG_RRULE_P(1), &len2);
+
+    const int result = memcmp(data1, data2, Min(len1, len2));
+    if (result != 0) {
+        return result;
     }
+    return (len1 > len2) - (len1 < len2);
+}
 
-    // Compare BY* arrays
-    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        // First compare the size field
-        if (tmp1.by[i].size != tmp2.by[i].size) {
-            PG_RETURN_BOOL(false);
-        }
+Datum pg_rrule_eq(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) == 0);
+}
 
-        // If both sizes are 0, continue to the next array
-        if (tmp1.by[i].size == 0) {
-            continue;
-        }
+Datum pg_rrule_ne(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) != 0);
+}
+
+Datum pg_rrule_lt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) < 0);
+}
 
-        short *array1 = tmp1.by[i].data;
-        short *array2 = tmp2.by[i].data;
+Datum pg_rrule_le(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) <= 0);
+}
 
-        // Both should have data if size > 0, but double-check
-        if ((array1 == NULL && array2 != NULL) ||
-            (array1 != NULL && array2 == NULL)) {
-            PG_RETURN_BOOL(false);
-        }
+Datum pg_rrule_gt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) > 0);
+}
 
-        if (array1 != NULL && array2 != NULL) {
-            int max_size;
-            switch (i) {
-                case ICAL_BY_SECOND:
-                    max_size = ICAL_BY_SECOND_SIZE;
-                    break;
-                case ICAL_BY_MINUTE:
-                    max_size = ICAL_BY_MINUTE_SIZE;
-                    break;
-                case ICAL_BY_HOUR:
-                    max_size = ICAL_BY_HOUR_SIZE;
-                    break;
-                case ICAL_BY_DAY:
-                    max_size = ICAL_BY_DAY_SIZE;
-                    break;
-                case ICAL_BY_MONTH_DAY:
-                    max_size = ICAL_BY_MONTHDAY_SIZE;
-                    break;
-                case ICAL_BY_WEEK_NO:
-                    max_size = ICAL_BY_WEEKNO_SIZE;
-                    break;
-                case ICAL_BY_YEAR_DAY:
-                    max_size = ICAL_BY_YEARDAY_SIZE;
-                    break;
-                case ICAL_BY_MONTH:
-                    max_size = ICAL_BY_MONTH_SIZE;
-                    break;
-                case ICAL_BY_SET_POS:
-                    max_size = ICAL_BY_SETPOS_SIZE;
-                    break;
-                default:
-                    continue; // Skip unknown by-rule types
-            }
+Datum pg_rrule_ge(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(pg_rrule_compare(fcinfo) >= 0);
+}
 
-            // Compare each element up to the size stored in the structure
-            for (int j = 0; j < tmp1.by[i].size && j < max_size; j++) {
-                if (array1[j] != array2[j]) {
-                    PG_RETURN_BOOL(false);
-                }
-            }
-        }
-    }
+Datum pg_rrule_cmp(PG_FUNCTION_ARGS) {
+    const int result = pg_rrule_compare(fcinfo);
+    PG_RETURN_INT32((result > 0) - (result < 0));
+}
 
-    PG_RETURN_BOOL(true);
+Datum pg_rrule_hash(PG_FUNCTION_ARGS) {
+    Size len;
+    const char *data = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &len);
+    return hash_any((const unsigned char *) data, (int) len);
 }
 
-Datum pg_rrule_ne(PG_FUNCTION_ARGS) {
-    // Reuse pg_rrule_eq and negate its result
-    bool result = DatumGetBool(DirectFunctionCall2(pg_rrule_eq, PG_GETARG_DATUM(0), PG_GETARG_DATUM(1)));
-    PG_RETURN_BOOL(!result);
+Datum pg_rrule_hash_extended(PG_FUNCTION_ARGS) {
+    Size len;
+    const char *data = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &len);
+    return hash_any_extended((const unsigned char *) data, (int) len, PG_GETARG_INT64(1));
 }
 
 /* Other functions */
 Datum pg_rrule_get_freq(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     if (flat_struct->freq == ICAL_NO_RECURRENCE) {
         PG_RETURN_NULL();
@@ -501,8 +2048,10 @@ Datum pg_rrule_get_freq(PG_FUNCTION_ARGS) {
 }
 
 Datum pg_rrule_get_until(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     if (icaltime_is_null_time(flat_struct->until)) {
         PG_RETURN_NULL();
@@ -513,45 +2062,44 @@ Datum pg_rrule_get_until(PG_FUNCTION_ARGS) {
 }
 
 Datum pg_rrule_get_untiltz(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     if (icaltime_is_null_time(flat_struct->until)) {
         PG_RETURN_NULL();
     }
 
-    long int gmtoff = 0;
-    icaltimezone *ical_tz = NULL;
-    if (pg_get_timezone_offset(session_timezone, &gmtoff)) {
-        ical_tz = icaltimezone_get_builtin_timezone_from_offset(gmtoff, pg_get_timezone_name(session_timezone));
-    }
-
-    if (ical_tz == NULL) {
-        elog(WARNING, "Can't get timezone from current session! Fallback to UTC.");
-        ical_tz = icaltimezone_get_utc_timezone();
-    }
+    icaltimezone *ical_tz = pg_rrule_get_session_timezone();
 
     pg_time_t until_pg_time_t = (pg_time_t) icaltime_as_timet_with_zone(flat_struct->until, ical_tz);
     PG_RETURN_TIMESTAMP(time_t_to_timestamptz(until_pg_time_t));
 }
 
 Datum pg_rrule_get_count(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     PG_RETURN_INT32(flat_struct->count);
 }
 
 Datum pg_rrule_get_interval(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     PG_RETURN_INT16(flat_struct->interval);
 }
 
 Datum pg_rrule_get_wkst(PG_FUNCTION_ARGS) {
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
+    struct icalrecurrencetype tmp;
+    flatten_to_tmp(varlena_data, &tmp);
+    const struct icalrecurrencetype *flat_struct = &tmp;
 
     if (flat_struct->week_start == ICAL_NO_WEEKDAY) {
         PG_RETURN_NULL();
@@ -564,7 +2112,7 @@ Datum pg_rrule_get_wkst(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_bysecond(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -574,7 +2122,7 @@ Datum pg_rrule_get_bysecond(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_byminute(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -584,7 +2132,7 @@ Datum pg_rrule_get_byminute(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_byhour(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -594,7 +2142,7 @@ Datum pg_rrule_get_byhour(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_byday(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -604,7 +2152,7 @@ Datum pg_rrule_get_byday(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_bymonthday(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -614,7 +2162,7 @@ Datum pg_rrule_get_bymonthday(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_byyearday(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -624,7 +2172,7 @@ Datum pg_rrule_get_byyearday(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_byweekno(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -634,7 +2182,7 @@ Datum pg_rrule_get_byweekno(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_bymonth(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -644,7 +2192,7 @@ Datum pg_rrule_get_bymonth(PG_FUNCTION_ARGS) {
 Datum pg_rrule_get_bysetpos(PG_FUNCTION_ARGS) {
     if (PG_ARGISNULL(0)) PG_RETURN_NULL();
 
-    char *varlena_data = (char*) PG_GETARG_POINTER(0);
+    char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
     struct icalrecurrencetype tmp;
     flatten_to_tmp(varlena_data, &tmp);
 
@@ -657,51 +2205,121 @@ Datum pg_rrule_get_occurrences(struct icalrecurrencetype recurrence, struct ical
 }
 
 Datum pg_rrule_get_occurrences_until(struct icalrecurrencetype recurrence, struct icaltimetype dtstart, struct icaltimetype until, bool use_tz) {
-    time_t *times_array = NULL;
-    unsigned int cnt = 0;
+    return pg_rrule_get_occurrences_between(recurrence, dtstart, icaltime_null_time(), until, use_tz);
+}
 
-    pg_rrule_rrule_to_time_t_array_until(recurrence, dtstart, until, &times_array, &cnt);
-    pg_time_t *pg_times_array = palloc(sizeof(pg_time_t) * cnt);
+Datum pg_rrule_get_occurrences_between(struct icalrecurrencetype recurrence, struct icaltimetype dtstart, struct icaltimetype from, struct icaltimetype until, bool use_tz) {
+    pg_rrule_iterator iter;
+    pg_rrule_iterator_init(&iter, recurrence, dtstart, until);
+    if (!icaltime_is_null_time(from)) {
+        pg_rrule_iterator_seek(&iter, from);
+    }
+
+    ArrayType *result_array = pg_rrule_build_occurrence_array(&iter, use_tz ? TIMESTAMPTZOID : TIMESTAMPOID);
+    pg_rrule_iterator_free(&iter);
+
+    PG_RETURN_ARRAYTYPE_P(result_array);
+}
 
-    unsigned int i;
+ArrayType *pg_rrule_build_occurrence_array(pg_rrule_iterator *iter, Oid element_type) {
+    // timestamp and timestamptz are both 8-byte, pass-by-value, double-aligned int64s, so the
+    // payload of a 1-D array without nulls is just a Timestamp[] right after the header
+    const Size header_size = ARR_OVERHEAD_NONULLS(1);
+    Size capacity = PG_RRULE_BATCH_SIZE; // so that doubling always makes room for a whole batch
+    Size cnt = 0;
 
-    for (i = 0; i < cnt; ++i) {
-        pg_times_array[i] = (pg_time_t) times_array[i];
+    Size max_size = MaxAllocSize;
+    if (pg_rrule_max_expansion_memory > 0) {
+        max_size = Min(max_size, (Size) pg_rrule_max_expansion_memory * 1024);
     }
+    const Size max_cnt = max_size > header_size ? (max_size - header_size) / sizeof(Timestamp) : 0;
+
+    ArrayType *result = palloc(header_size + capacity * sizeof(Timestamp));
+    Timestamp *elems = (Timestamp *) ((char *) result + header_size);
+
+    pg_time_t batch[PG_RRULE_BATCH_SIZE];
+    int n;
+    while ((n = pg_rrule_iterator_next_batch(iter, batch, PG_RRULE_BATCH_SIZE)) > 0) {
+        if (cnt + n > max_cnt) {
+            if (pg_rrule_limit_action_setting != PG_RRULE_LIMIT_TRUNCATE) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                         errmsg("too many occurrences, array size exceeds the maximum allowed (%d)", (int) max_cnt),
+                         max_size < MaxAllocSize ? errhint("See pg_rrule.max_expansion_memory.") : 0));
+            }
 
-    free(times_array);
+            // Truncating: keep what fits and stop expanding
+            n = (int) (max_cnt - cnt);
+            iter->done = true;
+        }
 
-    Datum *const datum_elems = palloc(sizeof(Datum) * cnt);
-    if (use_tz) {
-        for (i = 0; i < cnt; ++i) {
-            datum_elems[i] = TimestampTzGetDatum(time_t_to_timestamptz(pg_times_array[i]));
+        if (cnt + n > capacity) {
+            capacity = Min(Max(capacity * 2, cnt + n), max_cnt);
+            result = repalloc(result, header_size + capacity * sizeof(Timestamp));
+            elems = (Timestamp *) ((char *) result + header_size);
         }
-    } else {
-        for (i = 0; i < cnt; ++i) {
-            datum_elems[i] = TimestampGetDatum(time_t_to_timestamptz(pg_times_array[i]));
+
+        // Same as time_t_to_timestamptz(), unrolled over the batch
+        for (int i = 0; i < n; i++) {
+            elems[cnt + i] = (batch[i] - ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)) * USECS_PER_SEC;
         }
+        cnt += n;
     }
 
-    pfree(pg_times_array);
-
-    int16 typlen;
-    bool typbyval;
-    char typalign;
+    if (cnt == 0) {
+        pfree(result);
+        return construct_empty_array(element_type);
+    }
 
-    const Oid ts_oid = use_tz ? TIMESTAMPTZOID : TIMESTAMPOID;
-    get_typlenbyvalalign(ts_oid, &typlen, &typbyval, &typalign);
+    SET_VARSIZE(result, header_size + cnt * sizeof(Timestamp));
+    result->ndim = 1;
+    result->dataoffset = 0;
+    result->elemtype = element_type;
+    ARR_DIMS(result)[0] = (int) cnt;
+    ARR_LBOUND(result)[0] = 1;
 
-    ArrayType *result_array = construct_array(datum_elems, cnt, ts_oid, typlen, typbyval, typalign);
-    PG_RETURN_ARRAYTYPE_P(result_array);
+    return result;
 }
 
-void pg_rrule_rrule_to_time_t_array(struct icalrecurrencetype recurrence, struct icaltimetype dtstart, time_t **const out_array, unsigned int *const out_count) {
-    pg_rrule_rrule_to_time_t_array_until(recurrence, dtstart, icaltime_null_time(), out_array, out_count);
+typedef struct pg_rrule_ical_guard {
+    MemoryContextCallback callback;
+    icalrecur_iterator *recur_iterator;     /* NULL once freed */
+} pg_rrule_ical_guard;
+
+static void pg_rrule_ical_guard_callback(void *arg) {
+    pg_rrule_ical_guard *guard = (pg_rrule_ical_guard *) arg;
+    if (guard->recur_iterator != NULL) {
+        icalrecur_iterator_free(guard->recur_iterator);
+        guard->recur_iterator = NULL;
+    }
 }
 
-void pg_rrule_rrule_to_time_t_array_until(struct icalrecurrencetype recurrence, struct icaltimetype dtstart, struct icaltimetype until, time_t **const out_array, unsigned int *const out_count) {
-    icalrecur_iterator *const recur_iterator = icalrecur_iterator_new(&recurrence, dtstart);
-    if (recur_iterator == NULL) {
+void pg_rrule_iterator_init(pg_rrule_iterator *iter, struct icalrecurrencetype recurrence, struct icaltimetype dtstart, struct icaltimetype until) {
+    iter->recurrence = recurrence;
+    iter->zone = (icaltimezone *) dtstart.zone;
+    pg_rrule_epoch_cache_init(&iter->epochs, iter->zone);
+    iter->dtstart = dtstart;
+    iter->from = icaltime_null_time();
+    iter->until = until;
+    iter->limit = 0;
+    iter->produced = 0;
+    iter->unlimited = false;
+    iter->done = false;
+    iter->guard = NULL;
+
+    pg_rrule_compiled compiled;
+    if (pg_rrule_native_engine && pg_rrule_compile(&iter->recurrence, dtstart, &compiled)) {
+        const bool has_until = !icaltime_is_null_time(until);
+
+        iter->native = true;
+        iter->recur_iterator = NULL;
+        pg_rrule_engine_init(&iter->engine, &compiled, has_until, has_until ? pg_rrule_civil_seconds(until) : 0);
+        return;
+    }
+
+    iter->native = false;
+    iter->recur_iterator = icalrecur_iterator_new(&iter->recurrence, dtstart);
+    if (iter->recur_iterator == NULL) {
         const icalerrorenum err = icalerrno;
         icalerror_clear_errno();
 
@@ -710,34 +2328,506 @@ void pg_rrule_rrule_to_time_t_array_until(struct icalrecurrencetype recurrence,
                  errmsg("iCal error: %s.", icalerror_strerror(err))));
     }
 
-    icalarray *const icaltimes_list = icalarray_new(sizeof(icaltimetype), 32);
-    struct icaltimetype ical_time = icalrecur_iterator_next(recur_iterator);
+    // libical allocates with malloc; free its iterator if an error or a cancel skips pg_rrule_iterator_free()
+    iter->guard = palloc(sizeof(pg_rrule_ical_guard));
+    iter->guard->recur_iterator = iter->recur_iterator;
+    iter->guard->callback.func = pg_rrule_ical_guard_callback;
+    iter->guard->callback.arg = iter->guard;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &iter->guard->callback);
+}
+
+void pg_rrule_iterator_seek(pg_rrule_iterator *iter, struct icaltimetype from) {
+    if (icaltime_compare(from, iter->dtstart) != 1) {
+        // Nothing to skip, the series starts inside the window
+        return;
+    }
+
+    iter->from = from;
+
+    // An empty window can be answered without touching the iterator
+    if (!icaltime_is_null_time(iter->until) && icaltime_compare(from, iter->until) == 1) {
+        iter->done = true;
+        return;
+    }
+
+    if (iter->native) {
+        pg_rrule_engine_seek(&iter->engine, pg_rrule_civil_seconds(from));
+        return;
+    }
+
+    // libical can't seek COUNT-bounded rules, as the skipped occurrences still count towards COUNT
+    if (iter->recurrence.count == 0 && !icalrecur_iterator_set_start(iter->recur_iterator, from)) {
+        // Fall back to skipping occurrences before `from` while iterating
+        icalerror_clear_errno();
+    }
+}
+
+/* Next occurrence as civil seconds of the iterator's zone */
+static bool pg_rrule_iterator_next_civil(pg_rrule_iterator *iter, int64 *out) {
+    if (iter->done || (!iter->native && iter->recur_iterator == NULL)) {
+        return false;
+    }
+
+    if (iter->limit > 0 && iter->produced >= iter->limit) {
+        iter->done = true;
+        return false;
+    }
 
-    if (icaltime_is_null_time(until)) {
-        while (icaltime_is_null_time(ical_time) == false) {
-            icalarray_append(icaltimes_list, &ical_time);
-            ical_time = icalrecur_iterator_next(recur_iterator);
+    if (!iter->unlimited && pg_rrule_max_occurrences > 0 && iter->produced >= pg_rrule_max_occurrences) {
+        if (pg_rrule_limit_action_setting != PG_RRULE_LIMIT_TRUNCATE) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("rrule expansion exceeds pg_rrule.max_occurrences (%d)", pg_rrule_max_occurrences),
+                     errhint("Bound the rule with UNTIL, COUNT or a window, or raise pg_rrule.max_occurrences.")));
         }
-    } else {
-        while (icaltime_is_null_time(ical_time) == false && icaltime_compare(ical_time, until) != 1) {
-            // while ical_time <= until
-            icalarray_append(icaltimes_list, &ical_time);
-            ical_time = icalrecur_iterator_next(recur_iterator);
+        iter->done = true;
+        return false;
+    }
+
+    CHECK_FOR_INTERRUPTS();
+
+    if (iter->native) {
+        // Bounds and COUNT are applied by the engine itself
+        if (!pg_rrule_engine_next(&iter->engine, out)) {
+            iter->done = true;
+            return false;
+        }
+
+        iter->produced++;
+        return true;
+    }
+
+    struct icaltimetype ical_time = icalrecur_iterator_next(iter->recur_iterator);
+
+    // Skip occurrences before the window; only needed when seeking wasn't possible
+    if (!icaltime_is_null_time(iter->from)) {
+        while (!icaltime_is_null_time(ical_time) && icaltime_compare(ical_time, iter->from) == -1) {
+            CHECK_FOR_INTERRUPTS();
+            ical_time = icalrecur_iterator_next(iter->recur_iterator);
+        }
+    }
+
+    // Stop at the end of the series or once ical_time > until
+    if (icaltime_is_null_time(ical_time) ||
+        (!icaltime_is_null_time(iter->until) && icaltime_compare(ical_time, iter->until) == 1)) {
+        iter->done = true;
+        return false;
+    }
+
+    *out = pg_rrule_civil_seconds(ical_time);
+    iter->produced++;
+    return true;
+}
+
+bool pg_rrule_iterator_next(pg_rrule_iterator *iter, pg_time_t *out) {
+    int64 civil;
+    if (!pg_rrule_iterator_next_civil(iter, &civil)) {
+        return false;
+    }
+
+    *out = (pg_time_t) pg_rrule_civil_to_epoch(&iter->epochs, civil);
+    return true;
+}
+
+int pg_rrule_iterator_next_batch(pg_rrule_iterator *iter, pg_time_t *out, int n) {
+    int64 civil[PG_RRULE_BATCH_SIZE];
+    int cnt = 0;
+
+    Assert(n <= PG_RRULE_BATCH_SIZE);
+    while (cnt < n && pg_rrule_iterator_next_civil(iter, &civil[cnt])) {
+        cnt++;
+    }
+
+    pg_rrule_civil_to_epoch_batch(&iter->epochs, civil, (int64 *) out, cnt);
+    return cnt;
+}
+
+void pg_rrule_iterator_free(pg_rrule_iterator *iter) {
+    if (iter->recur_iterator != NULL) {
+        icalrecur_iterator_free(iter->recur_iterator);
+        iter->recur_iterator = NULL;
+        iter->guard->recur_iterator = NULL;
+    }
+    iter->done = true;
+}
+
+bool pg_rrule_arith_init(const struct icalrecurrencetype *recurrence, struct icaltimetype dtstart, pg_rrule_arith *arith) {
+    static const int64 freq_seconds[] = {
+        [ICAL_SECONDLY_RECURRENCE] = 1,
+        [ICAL_MINUTELY_RECURRENCE] = SECS_PER_MINUTE,
+        [ICAL_HOURLY_RECURRENCE] = SECS_PER_HOUR,
+        [ICAL_DAILY_RECURRENCE] = SECS_PER_DAY,
+        [ICAL_WEEKLY_RECURRENCE] = 7 * SECS_PER_DAY,
+    };
+
+    if (recurrence->freq < ICAL_SECONDLY_RECURRENCE || recurrence->freq > ICAL_WEEKLY_RECURRENCE) {
+        return false;
+    }
+
+    if (recurrence->rscale != NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        if (recurrence->by[i].size > 0) {
+            return false;
+        }
+    }
+
+    const bool has_until = !icaltime_is_null_time(recurrence->until);
+    if (has_until && recurrence->until.is_date) {
+        return false;
+    }
+
+    arith->start = pg_rrule_civil_seconds(dtstart);
+    arith->step = (int64) (recurrence->interval > 0 ? recurrence->interval : 1) * freq_seconds[recurrence->freq];
+    arith->bounded = false;
+    arith->last_index = 0;
+
+    if (recurrence->count > 0) {
+        arith->bounded = true;
+        arith->last_index = recurrence->count - 1;
+    }
+
+    if (has_until) {
+        // libical compares UNTIL in UTC, see pg_rrule_get_until()
+        time_t until_t = icaltime_as_timet_with_zone(recurrence->until, icaltimezone_get_utc_timezone());
+        int64 until_civil = pg_rrule_civil_seconds(icaltime_from_timet_with_zone(until_t, 0, dtstart.zone));
+        int64 until_index = until_civil < arith->start ? -1 : (until_civil - arith->start) / arith->step;
+
+        if (!arith->bounded || until_index < arith->last_index) {
+            arith->bounded = true;
+            arith->last_index = until_index;
         }
     }
 
-    icalrecur_iterator_free(recur_iterator);
+    return true;
+}
+
+int64 pg_rrule_arith_count(const pg_rrule_arith *arith, int64 lo, int64 hi) {
+    if (hi < arith->start || hi < lo) {
+        return 0;
+    }
+
+    // First index at or after lo (ceiling division), last index at or before hi
+    int64 first_index = lo <= arith->start ? 0 : (lo - arith->start + arith->step - 1) / arith->step;
+    int64 last_index = (hi - arith->start) / arith->step;
+
+    if (arith->bounded && arith->last_index < last_index) {
+        last_index = arith->last_index;
+    }
+
+    return last_index >= first_index ? last_index - first_index + 1 : 0;
+}
+
+bool pg_rrule_get_span(const struct icalrecurrencetype *recurrence, struct icaltimetype dtstart, pg_time_t *first, bool *bounded, pg_time_t *last) {
+    icaltimezone *zone = (icaltimezone *) dtstart.zone;
+
+    pg_rrule_arith arith;
+    if (pg_rrule_arith_init(recurrence, dtstart, &arith)) {
+        if (arith.bounded && arith.last_index < 0) {
+            return false;
+        }
+
+        *first = (pg_time_t) icaltime_as_timet_with_zone(dtstart, zone);
+        *bounded = arith.bounded;
+        if (arith.bounded) {
+            struct icaltimetype last_time = pg_rrule_civil_time(arith.start + arith.last_index * arith.step, dtstart);
+            *last = (pg_time_t) icaltime_as_timet_with_zone(last_time, zone);
+        }
+        return true;
+    }
+
+    pg_rrule_iterator iter;
+    pg_time_t occurrence;
+
+    pg_rrule_iterator_init(&iter, *recurrence, dtstart, icaltime_null_time());
+    iter.unlimited = true;
+    const bool found = pg_rrule_iterator_next(&iter, first);
+    pg_rrule_iterator_free(&iter);
+
+    if (!found) {
+        return false;
+    }
+
+    *bounded = recurrence->count > 0 || !icaltime_is_null_time(recurrence->until);
+    if (!*bounded) {
+        return true;
+    }
+
+    if (recurrence->count > 0) {
+        // The COUNT-th occurrence can only be found by numbering all of them
+        *last = *first;
+        pg_rrule_iterator_init(&iter, *recurrence, dtstart, icaltime_null_time());
+        iter.unlimited = true;
+        while (pg_rrule_iterator_next(&iter, &occurrence)) {
+            *last = occurrence;
+        }
+        pg_rrule_iterator_free(&iter);
+        return true;
+    }
+
+    // Search backwards from UNTIL in growing windows, each of which is expanded from its own start.
+    // The rule's UNTIL ends every window, so the first non-empty one holds the last occurrence.
+    const pg_time_t until_t = (pg_time_t) icaltime_as_timet_with_zone(recurrence->until, icaltimezone_get_utc_timezone());
+    const int interval = recurrence->interval > 0 ? recurrence->interval : 1;
+    int64 lookback;
+    switch (recurrence->freq) {
+        case ICAL_SECONDLY_RECURRENCE: lookback = interval; break;
+        case ICAL_MINUTELY_RECURRENCE: lookback = (int64) interval * SECS_PER_MINUTE; break;
+        case ICAL_HOURLY_RECURRENCE: lookback = (int64) interval * SECS_PER_HOUR; break;
+        case ICAL_DAILY_RECURRENCE: lookback = (int64) interval * SECS_PER_DAY; break;
+        case ICAL_WEEKLY_RECURRENCE: lookback = (int64) interval * 7 * SECS_PER_DAY; break;
+        case ICAL_MONTHLY_RECURRENCE: lookback = (int64) interval * 31 * SECS_PER_DAY; break;
+        default: lookback = (int64) interval * 366 * SECS_PER_DAY; break;
+    }
+
+    for (;;) {
+        const pg_time_t from_t = until_t - lookback > *first ? until_t - lookback : *first;
+        bool any = false;
+
+        pg_rrule_iterator_init(&iter, *recurrence, dtstart, icaltime_null_time());
+        iter.unlimited = true;
+        pg_rrule_iterator_seek(&iter, icaltime_from_timet_with_zone((time_t) from_t, 0, zone));
+        while (pg_rrule_iterator_next(&iter, &occurrence)) {
+            *last = occurrence;
+            any = true;
+        }
+        pg_rrule_iterator_free(&iter);
+
+        // The window starting at the first occurrence can't be empty
+        if (any || from_t == *first) {
+            return true;
+        }
+
+        lookback *= 2;
+    }
+}
+
+/* Length of the FREQ periods in seconds, months and years on average */
+static const double pg_rrule_period_seconds[] = {
+    [ICAL_SECONDLY_RECURRENCE] = 1.0,
+    [ICAL_MINUTELY_RECURRENCE] = SECS_PER_MINUTE,
+    [ICAL_HOURLY_RECURRENCE] = SECS_PER_HOUR,
+    [ICAL_DAILY_RECURRENCE] = SECS_PER_DAY,
+    [ICAL_WEEKLY_RECURRENCE] = 7.0 * SECS_PER_DAY,
+    [ICAL_MONTHLY_RECURRENCE] = DAYS_PER_YEAR / MONTHS_PER_YEAR * SECS_PER_DAY,
+    [ICAL_YEARLY_RECURRENCE] = DAYS_PER_YEAR * SECS_PER_DAY,
+};
+
+/* Occurrences per FREQ period, following the expand/limit table of RFC 5545 section 3.3.10 */
+static double pg_rrule_estimate_per_period(const struct icalrecurrencetype *recurrence) {
+    const icalrecurrencetype_frequency freq = recurrence->freq;
+    const double days_per_month = DAYS_PER_YEAR / MONTHS_PER_YEAR;
+    const double seconds = recurrence->by[ICAL_BY_SECOND].size;
+    const double minutes = recurrence->by[ICAL_BY_MINUTE].size;
+    const double hours = recurrence->by[ICAL_BY_HOUR].size;
+    const double monthdays = recurrence->by[ICAL_BY_MONTH_DAY].size;
+    const double yeardays = recurrence->by[ICAL_BY_YEAR_DAY].size;
+    const double weeknos = recurrence->by[ICAL_BY_WEEK_NO].size;
+    const double months = recurrence->by[ICAL_BY_MONTH].size;
+
+    // Positional days (1MO, -1FR) happen once per month or year, plain ones every week
+    double positional_days = 0;
+    double weekdays = 0;
+    for (int i = 0; i < recurrence->by[ICAL_BY_DAY].size; i++) {
+        if (icalrecurrencetype_day_position(recurrence->by[ICAL_BY_DAY].data[i]) != 0) {
+            positional_days++;
+        } else {
+            weekdays++;
+        }
+    }
+    const double days = positional_days + weekdays;
+
+    // Parts finer than FREQ expand, the others limit
+    double n = 1.0;
+    if (seconds > 0) {
+        n *= freq > ICAL_SECONDLY_RECURRENCE ? seconds : seconds / 60.0;
+    }
+    if (minutes > 0) {
+        n *= freq > ICAL_MINUTELY_RECURRENCE ? minutes : minutes / 60.0;
+    }
+    if (hours > 0) {
+        n *= freq > ICAL_HOURLY_RECURRENCE ? hours : hours / 24.0;
+    }
+
+    switch (freq) {
+        case ICAL_WEEKLY_RECURRENCE:
+            n *= days > 0 ? days : 1.0;
+            if (monthdays > 0) {
+                n *= monthdays / days_per_month;
+            }
+            if (months > 0) {
+                n *= months / MONTHS_PER_YEAR;
+            }
+            break;
+        case ICAL_MONTHLY_RECURRENCE:
+            if (monthdays > 0) {
+                n *= days > 0 ? monthdays * days / 7.0 : monthdays;
+            } else if (days > 0) {
+                n *= positional_days + weekdays * days_per_month / 7.0;
+            }
+            if (months > 0) {
+                n *= months / MONTHS_PER_YEAR;
+            }
+            break;
+        case ICAL_YEARLY_RECURRENCE:
+            if (yeardays > 0) {
+                n *= yeardays;
+            } else if (weeknos > 0) {
+                n *= weeknos * (days > 0 ? days : 1.0);
+            } else if (monthdays > 0) {
+                n *= (months > 0 ? months : MONTHS_PER_YEAR) * (days > 0 ? monthdays * days / 7.0 : monthdays);
+            } else if (days > 0) {
+                n *= months > 0 ? months * (positional_days + weekdays * days_per_month / 7.0)
+                                : positional_days + weekdays * DAYS_PER_YEAR / 7.0;
+            } else if (months > 0) {
+                n *= months;
+            }
+            break;
+        default:
+            // SECONDLY to DAILY: every day part limits
+            if (days > 0) {
+                n *= days / 7.0;
+            }
+            if (monthdays > 0) {
+                n *= monthdays / days_per_month;
+            }
+            if (yeardays > 0) {
+                n *= yeardays / DAYS_PER_YEAR;
+            }
+            if (weeknos > 0) {
+                n *= weeknos / (DAYS_PER_YEAR / 7.0);
+            }
+            if (months > 0) {
+                n *= months / MONTHS_PER_YEAR;
+            }
+            break;
+    }
+
+    if (recurrence->by[ICAL_BY_SET_POS].size > 0) {
+        n = Min(n, (double) recurrence->by[ICAL_BY_SET_POS].size);
+    }
+    return n;
+}
+
+double pg_rrule_estimate_rate(const struct icalrecurrencetype *recurrence) {
+    if (recurrence->freq < ICAL_SECONDLY_RECURRENCE || recurrence->freq > ICAL_YEARLY_RECURRENCE) {
+        return 0.0;
+    }
+
+    const int interval = recurrence->interval > 0 ? recurrence->interval : 1;
+    return pg_rrule_estimate_per_period(recurrence) / (pg_rrule_period_seconds[recurrence->freq] * interval);
+}
+
+double pg_rrule_estimate_occurrences(const struct icalrecurrencetype *recurrence, TimestampTz lower, TimestampTz upper) {
+    const double unbounded = pg_rrule_max_occurrences > 0 ? pg_rrule_max_occurrences : 1000000.0;
+
+    if (recurrence->freq < ICAL_SECONDLY_RECURRENCE || recurrence->freq > ICAL_YEARLY_RECURRENCE) {
+        return 1.0;
+    }
+
+    if (!icaltime_is_null_time(recurrence->until)) {
+        const pg_time_t until = (pg_time_t) icaltime_as_timet_with_zone(recurrence->until, icaltimezone_get_utc_timezone());
+        upper = Min(upper, time_t_to_timestamptz(until));
+    }
+
+    double estimate = unbounded;
+    if (lower != DT_NOBEGIN && upper != DT_NOEND) {
+        const double rate = pg_rrule_estimate_rate(recurrence);
+        const double window = upper > lower ? (double) (upper - lower) / USECS_PER_SEC : 0.0;
+        estimate = Min(rate * window + 1.0, unbounded);
+    }
+
+    if (recurrence->count > 0) {
+        estimate = Min(estimate, (double) recurrence->count);
+    }
+    return Max(estimate, 1.0);
+}
+
+pg_rrule_match pg_rrule_match_fast(const struct icalrecurrencetype *recurrence, struct icaltimetype dtstart, struct icaltimetype tt) {
+    pg_rrule_compiled compiled;
+
+    // COUNT depends on every previous occurrence; the remaining parts are decided by the compiled masks
+    if (recurrence->count > 0 || !pg_rrule_compile(recurrence, dtstart, &compiled)) {
+        return PG_RRULE_MATCH_UNKNOWN;
+    }
+
+    return pg_rrule_compiled_matches(&compiled, tt) ? PG_RRULE_MATCH_YES : PG_RRULE_MATCH_NO;
+}
+
+/* Zone names meaning UTC, which libical only knows through icaltimezone_get_utc_timezone() */
+static icaltimezone *pg_rrule_lookup_timezone(const char *name) {
+    static const char *const utc_names[] = {"UTC", "Etc/UTC", "GMT", "Etc/GMT", "UCT", "Etc/UCT", "Zulu", "Etc/Zulu"};
+
+    for (int i = 0; i < lengthof(utc_names); i++) {
+        if (pg_strcasecmp(name, utc_names[i]) == 0) {
+            return icaltimezone_get_utc_timezone();
+        }
+    }
+
+    icaltimezone *ical_tz = icaltimezone_get_builtin_timezone(name);
+    icalerror_clear_errno();
+    return ical_tz;
+}
+
+icaltimezone *pg_rrule_get_session_timezone(void) {
+    // Built-in zones live as long as the process, so the pointer can be kept.
+    // session_timezone is replaced (never modified) whenever TimeZone changes.
+    static const pg_tz *cached_pg_tz = NULL;
+    static icaltimezone *cached_ical_tz = NULL;
+
+    if (cached_ical_tz != NULL && cached_pg_tz == session_timezone) {
+        return cached_ical_tz;
+    }
+
+    const char *name = pg_get_timezone_name(session_timezone);
+    icaltimezone *ical_tz = pg_rrule_lookup_timezone(name);
+
+    long int gmtoff = 0;
+    if (ical_tz == NULL && pg_get_timezone_offset(session_timezone, &gmtoff)) {
+        ical_tz = icaltimezone_get_builtin_timezone_from_offset(gmtoff, name);
+    }
+
+    if (ical_tz == NULL) {
+        elog(WARNING, "Can't get timezone from current session! Fallback to UTC.");
+        ical_tz = icaltimezone_get_utc_timezone();
+    }
+
+    cached_pg_tz = session_timezone;
+    cached_ical_tz = ical_tz;
+    return ical_tz;
+}
+
+icaltimezone *pg_rrule_get_named_timezone(const text *name) {
+    static char cached_name[TZ_STRLEN_MAX + 1] = "";
+    static icaltimezone *cached_ical_tz = NULL;
 
-    const unsigned int cnt = (*out_count) = icaltimes_list->num_elements;
-    time_t *times_array = (*out_array) = malloc(sizeof(time_t) * cnt);
+    const int len = VARSIZE_ANY_EXHDR(name);
+    if (len > TZ_STRLEN_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("time zone name too long")));
+    }
+
+    char zone_name[TZ_STRLEN_MAX + 1];
+    memcpy(zone_name, VARDATA_ANY(name), len);
+    zone_name[len] = '\0';
 
-    unsigned int i = 0;
-    for (i = 0; i < cnt; ++i) {
-        ical_time = (*(icaltimetype *) icalarray_element_at(icaltimes_list, i));
-        times_array[i] = icaltime_as_timet_with_zone(ical_time, dtstart.zone);
+    if (cached_ical_tz != NULL && strcmp(zone_name, cached_name) == 0) {
+        return cached_ical_tz;
+    }
+
+    icaltimezone *ical_tz = pg_rrule_lookup_timezone(zone_name);
+    if (ical_tz == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("time zone \"%s\" not recognized", zone_name)));
     }
 
-    icalarray_free(icaltimes_list);
+    strlcpy(cached_name, zone_name, sizeof(cached_name));
+    cached_ical_tz = ical_tz;
+    return ical_tz;
 }
 
 Datum pg_rrule_get_bypart(struct icalrecurrencetype *recurrence_ref, icalrecurrencetype_byrule part, size_t max_size) {
@@ -780,27 +2870,88 @@ Datum pg_rrule_get_bypart(struct icalrecurrencetype *recurrence_ref, icalrecurre
 }
 
 void flatten_to_tmp(char *varlena_data, struct icalrecurrencetype *tmp) {
-    struct icalrecurrencetype *flat_struct = (struct icalrecurrencetype*)VARDATA(varlena_data);
-    char *base_addr = VARDATA(varlena_data);
+    const pg_rrule_expanded *expanded = pg_rrule_get_expanded(PointerGetDatum(varlena_data));
+    if (expanded != NULL) {
+        *tmp = expanded->recurrence;
+        return;
+    }
+
+    pg_rrule_decode(VARDATA_ANY(varlena_data), VARSIZE_ANY_EXHDR(varlena_data), tmp);
+}
+
+/* A legacy UNTIL, which rrule_in only ever made from a valid date and time */
+static bool pg_rrule_legacy_until_valid(struct icaltimetype until) {
+    if (until.is_date != 0 && until.is_date != 1) {
+        return false;
+    }
+    if (until.year < 1 || until.year > 9999 || until.month < 1 || until.month > 12 ||
+        until.day < 1 || until.day > icaltime_days_in_month(until.month, until.year)) {
+        return false;
+    }
+    if (until.is_date) {
+        return until.hour == 0 && until.minute == 0 && until.second == 0;
+    }
+    return until.hour >= 0 && until.hour <= 23 && until.minute >= 0 && until.minute <= 59 &&
+           until.second >= 0 && until.second <= 60;
+}
+
+void pg_rrule_recv_legacy(StringInfo buf, struct icalrecurrencetype *tmp) {
+    memset(tmp, 0, sizeof(struct icalrecurrencetype));
+
+    // Receive basic fields; the sender's refcount means nothing here
+    (void) pq_getmsgint(buf, 4);
+    tmp->refcount = 1;
+    tmp->freq = (icalrecurrencetype_frequency) (int32) pq_getmsgint(buf, 4);
+    tmp->count = (int32) pq_getmsgint(buf, 4);
+    tmp->interval = (short) pq_getmsgint(buf, 2);
+    tmp->week_start = (icalrecurrencetype_weekday) (int32) pq_getmsgint(buf, 4);
+    tmp->skip = (icalrecurrencetype_skip) (int32) pq_getmsgint(buf, 4);
+
+    // Receive until time; all zero means none, as icaltime_null_time()
+    tmp->until.year = (int32) pq_getmsgint(buf, 4);
+    tmp->until.month = (int32) pq_getmsgint(buf, 4);
+    tmp->until.day = (int32) pq_getmsgint(buf, 4);
+    tmp->until.hour = (int32) pq_getmsgint(buf, 4);
+    tmp->until.minute = (int32) pq_getmsgint(buf, 4);
+    tmp->until.second = (int32) pq_getmsgint(buf, 4);
+    tmp->until.is_date = (int32) pq_getmsgint(buf, 4);
+    if (tmp->until.year != 0 || tmp->until.month != 0 || tmp->until.day != 0 || tmp->until.hour != 0 ||
+        tmp->until.minute != 0 || tmp->until.second != 0 || tmp->until.is_date != 0) {
+        if (!pg_rrule_legacy_until_valid(tmp->until)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                     errmsg("invalid rrule value"),
+                     errdetail("UNTIL is out of range.")));
+        }
+        tmp->until.zone = icaltimezone_get_utc_timezone();
+    }
 
-    // Copy the base structure
-    memcpy(tmp, flat_struct, sizeof(struct icalrecurrencetype));
+    // Receive rscale
+    int32 rscale_len = (int32) pq_getmsgint(buf, 4);
+    if (rscale_len >= 0) {
+        tmp->rscale = pnstrdup(pq_getmsgbytes(buf, rscale_len), rscale_len);
+    }
 
-    // Convert offsets back to real pointers for by arrays
+    // Receive by arrays; a negative size is caught below
     for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
-        if (flat_struct->by[i].size > 0 && flat_struct->by[i].data != NULL) {
-            size_t offset = (size_t)flat_struct->by[i].data;
-            tmp->by[i].data = (short*)(base_addr + offset);
-        } else {
-            tmp->by[i].data = NULL;
+        const short size = (short) pq_getmsgint(buf, 2);
+
+        tmp->by[i].size = size;
+        if (size > 0) {
+            tmp->by[i].data = palloc(size * sizeof(short));
+
+            for (int j = 0; j < size; j++) {
+                tmp->by[i].data[j] = (short) pq_getmsgint(buf, 2);
+            }
         }
     }
 
-    // Convert rscale offset back to pointer
-    if (flat_struct->rscale != NULL) {
-        size_t offset = (size_t)flat_struct->rscale;
-        tmp->rscale = base_addr + offset;
-    } else {
-        tmp->rscale = NULL;
+    // The same checks as for stored values, before the fields are narrowed to bytes by pg_rrule_encode()
+    const char *invalid = pg_rrule_validate(tmp);
+    if (invalid != NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid rrule value"),
+                 errdetail("%s is out of range.", invalid)));
     }
-}
\ No newline at end of file
+}
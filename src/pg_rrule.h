@@ -5,8 +5,17 @@
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <pgtime.h>
 #include <lib/stringinfo.h>
 #include <libpq/pqformat.h>
+#include <utils/array.h>
+
+#include "pg_rrule_engine.h"
+#include "pg_rrule_storage.h"
+#include "pg_rrule_series.h"
+#include "pg_rrule_cache.h"
+#include "pg_rrule_shared_cache.h"
+#include "pg_rrule_limits.h"
 
 PG_MODULE_MAGIC;
 
@@ -18,8 +27,9 @@ PG_MODULE_MAGIC;
  * pg_rrule_in - Text input function for rrule type
  *
  * Parses a string representation of an RRULE (RFC 5545) and converts it
- * to the internal icalrecurrencetype structure. The input should be the
- * RRULE content without the "RRULE:" prefix.
+ * to the internal icalrecurrencetype structure, stored in the compact
+ * format described in pg_rrule_storage.h. The input should be the RRULE
+ * content without the "RRULE:" prefix.
  *
  * Example input: "FREQ=DAILY;INTERVAL=1;BYHOUR=9;BYMINUTE=0;BYSECOND=0"
  *
@@ -48,15 +58,9 @@ Datum pg_rrule_out(PG_FUNCTION_ARGS);
 /**
  * pg_rrule_send - Binary output function for rrule type
  *
- * Serializes an icalrecurrencetype structure to binary format for storage
- * and network transmission. This ensures data integrity across different
- * client contexts and connection types.
- *
- * Serializes all fields including:
- * - Core fields (freq, week_start, count, interval)
- * - Until datetime with timezone information
- * - All BY* rule arrays (BYSECOND, BYMINUTE, BYHOUR, etc.)
- * - RSCALE calendar system identifier
+ * Sends the rule in the on-disk format (see pg_rrule_storage.h), which is
+ * versioned and independent of libical's struct layout. Stored values in
+ * the current format are copied to the wire without decoding them.
  *
  * @param fcinfo Function call info containing rrule pointer argument
  * @return Datum containing bytea with serialized binary data
@@ -68,12 +72,13 @@ Datum pg_rrule_send(PG_FUNCTION_ARGS);
 /**
  * pg_rrule_recv - Binary input function for rrule type
  *
- * Deserializes binary data back to an icalrecurrencetype structure.
- * This function reconstructs the complete RRULE from the binary format
- * created by pg_rrule_send.
+ * Accepts the format written by pg_rrule_send, validating it and storing
+ * it in canonical form. The field-by-field format sent by earlier versions
+ * of the extension is still accepted, see pg_rrule_recv_legacy.
  *
  * @param fcinfo Function call info containing internal buffer argument
- * @return Datum containing pointer to reconstructed icalrecurrencetype
+ * @return Datum containing the rrule varlena
+ * @throws ERROR if the payload is malformed
  * @see https://www.postgresql.org/docs/17//sql-createtype.html
  */
 PG_FUNCTION_INFO_V1(pg_rrule_recv);
@@ -132,17 +137,566 @@ Datum pg_rrule_get_occurrences_dtstart(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_dtstart_until);
 Datum pg_rrule_get_occurrences_dtstart_until(PG_FUNCTION_ARGS);
 
+/**
+ * pg_rrule_get_occurrences_window_tz - Generate occurrences inside a window with timezone
+ *
+ * Generates the timestamp occurrences falling between window_start and
+ * window_end (both inclusive). The iterator is moved straight to the window
+ * instead of walking every occurrence since dtstart, except for COUNT-bounded
+ * rules where the preceding occurrences still have to be counted.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamptz
+ * @return Datum containing array of timestamptz values within the window
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_window_tz);
+Datum pg_rrule_get_occurrences_window_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_get_occurrences_window - Generate occurrences inside a window without timezone
+ *
+ * Same as pg_rrule_get_occurrences_window_tz, treating times as
+ * local/naive timestamps.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamp
+ * @return Datum containing array of timestamp values within the window
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_window);
+Datum pg_rrule_get_occurrences_window(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_get_occurrences_dtstart_zone - Generate occurrences in a named timezone
+ *
+ * Same as pg_rrule_get_occurrences_dtstart_tz, but the series is expanded
+ * in the IANA zone given as last argument instead of the session timezone,
+ * so DST transitions of that zone are followed.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart timestamptz and zone name
+ * @return Datum containing array of timestamptz values
+ * @throws ERROR if the zone name is not known
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_dtstart_zone);
+Datum pg_rrule_get_occurrences_dtstart_zone(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_get_occurrences_dtstart_until_zone - Generate occurrences until a time in a named timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart and until timestamptz and zone name
+ * @return Datum containing array of timestamptz values
+ * @throws ERROR if the zone name is not known
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_dtstart_until_zone);
+Datum pg_rrule_get_occurrences_dtstart_until_zone(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_get_occurrences_window_zone - Generate occurrences inside a window in a named timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start
+ *               and window end timestamptz and zone name
+ * @return Datum containing array of timestamptz values within the window
+ * @throws ERROR if the zone name is not known
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_get_occurrences_window_zone);
+Datum pg_rrule_get_occurrences_window_zone(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Streaming Occurrence Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_occurrences_dtstart_tz - Stream occurrences with timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_dtstart_tz. Occurrences
+ * are produced one row per call, so a LIMIT or an early-terminating join
+ * only pays for the rows it actually consumes.
+ *
+ * @param fcinfo Function call info containing rrule and timestamptz arguments
+ * @return Datum containing the next timestamptz occurrence
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_dtstart_tz);
+Datum pg_rrule_occurrences_dtstart_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_dtstart_until_tz - Stream bounded occurrences with timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_dtstart_until_tz.
+ *
+ * @param fcinfo Function call info containing rrule, start timestamptz, and end timestamptz
+ * @return Datum containing the next timestamptz occurrence within the specified range
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_dtstart_until_tz);
+Datum pg_rrule_occurrences_dtstart_until_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_dtstart - Stream occurrences without timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_dtstart.
+ *
+ * @param fcinfo Function call info containing rrule and timestamp arguments
+ * @return Datum containing the next timestamp occurrence
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_dtstart);
+Datum pg_rrule_occurrences_dtstart(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_dtstart_until - Stream bounded occurrences without timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_dtstart_until.
+ *
+ * @param fcinfo Function call info containing rrule, start timestamp, and end timestamp
+ * @return Datum containing the next timestamp occurrence within the specified range
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_dtstart_until);
+Datum pg_rrule_occurrences_dtstart_until(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_window_tz - Stream occurrences inside a window with timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_window_tz.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamptz
+ * @return Datum containing the next timestamptz occurrence within the window
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_window_tz);
+Datum pg_rrule_occurrences_window_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_window - Stream occurrences inside a window without timezone
+ *
+ * Set-returning variant of pg_rrule_get_occurrences_window.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamp
+ * @return Datum containing the next timestamp occurrence within the window
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_window);
+Datum pg_rrule_occurrences_window(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Batch Occurrence Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_occurrences_batch_tz - Stream the occurrences of many rules inside a window with timezone
+ *
+ * Expands rules[i] from dtstarts[i] for every i, with the timezone, element
+ * types and window resolved once for the whole batch. Items repeating an
+ * earlier (rule, dtstart) pair reuse its expansion. Items with a NULL rule
+ * or dtstart produce no rows.
+ *
+ * @param fcinfo Function call info containing rrule[], timestamptz[], window start and window end timestamptz
+ * @return Datum containing the next (idx, occurrence) record, idx being the subscript of the item
+ * @throws ERROR if the arrays are multidimensional or of different lengths
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_batch_tz);
+Datum pg_rrule_occurrences_batch_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurrences_batch - Stream the occurrences of many rules inside a window without timezone
+ *
+ * Same as pg_rrule_occurrences_batch_tz, for timestamp.
+ *
+ * @param fcinfo Function call info containing rrule[], timestamp[], window start and window end timestamp
+ * @return Datum containing the next (idx, occurrence) record, idx being the subscript of the item
+ * @throws ERROR if the arrays are multidimensional or of different lengths
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_batch);
+Datum pg_rrule_occurrences_batch(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Scheduling Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_next_occurrence_tz - First occurrence strictly after a point in time, with timezone
+ *
+ * Seeks to `after` and stops at the first occurrence, so the cost doesn't
+ * grow with the history of the series and rules without COUNT/UNTIL are fine.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart and after timestamptz
+ * @return Datum containing timestamptz or NULL if the series has ended
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_next_occurrence_tz);
+Datum pg_rrule_next_occurrence_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_next_occurrence - First occurrence strictly after a point in time, without timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart and after timestamp
+ * @return Datum containing timestamp or NULL if the series has ended
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_next_occurrence);
+Datum pg_rrule_next_occurrence(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_next_occurrences_tz - Next n occurrences strictly after a point in time, with timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, after timestamptz and n
+ * @return Datum containing array of at most n timestamptz values
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_next_occurrences_tz);
+Datum pg_rrule_next_occurrences_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_next_occurrences - Next n occurrences strictly after a point in time, without timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, after timestamp and n
+ * @return Datum containing array of at most n timestamp values
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_next_occurrences);
+Datum pg_rrule_next_occurrences(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_count_occurrences_tz - Count occurrences inside a window with timezone
+ *
+ * Counts the occurrences between window_start and window_end (both
+ * inclusive) without materializing them. Rules without BY* parts and a
+ * SECONDLY to WEEKLY frequency are counted in closed form; everything else
+ * seeks to the window and only advances the iterator.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamptz
+ * @return Datum containing int8 count
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_count_occurrences_tz);
+Datum pg_rrule_count_occurrences_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_count_occurrences - Count occurrences inside a window without timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart, window start and window end timestamp
+ * @return Datum containing int8 count
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_count_occurrences);
+Datum pg_rrule_count_occurrences(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Membership Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_occurs_at_tz - Check whether a timestamp is an occurrence, with timezone
+ *
+ * Decides membership directly from the rule: the wall clock time of `ts`
+ * is checked against the BY* sets (or the DTSTART defaults they replace)
+ * and the FREQ/INTERVAL period. Only rules using BYSETPOS, COUNT, BYWEEKNO,
+ * positional BYDAY (e.g. 1MO) or RSCALE fall back to a seek bounded by `ts`.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart and ts timestamptz
+ * @return Datum containing boolean
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurs_at_tz);
+Datum pg_rrule_occurs_at_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurs_at - Check whether a timestamp is an occurrence, without timezone
+ *
+ * @param fcinfo Function call info containing rrule, dtstart and ts timestamp
+ * @return Datum containing boolean
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurs_at);
+Datum pg_rrule_occurs_at(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Span Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_span_tz - First and last occurrence of a series, with timezone
+ *
+ * Both bounds are inclusive; the upper bound is infinite for series without
+ * COUNT or UNTIL, and the range is empty for series without occurrences.
+ * Fixed-step rules are answered in closed form, UNTIL-bounded rules by
+ * expanding short windows that end at UNTIL.
+ *
+ * The series is expanded in the session timezone, so the function is only
+ * STABLE; expression indexes use pg_rrule_span_zone instead.
+ *
+ * @param fcinfo Function call info containing rrule and dtstart timestamptz
+ * @return Datum containing tstzrange
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_span_tz);
+Datum pg_rrule_span_tz(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_span_zone - First and last occurrence of a series in a named timezone
+ *
+ * Same as pg_rrule_span_tz, but the series is expanded in the IANA zone
+ * given as last argument, which makes the result independent of the
+ * session and the function IMMUTABLE.
+ *
+ * @param fcinfo Function call info containing rrule, dtstart timestamptz and zone name
+ * @return Datum containing tstzrange
+ * @throws ERROR if the zone name is not known
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_span_zone);
+Datum pg_rrule_span_zone(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_span - First and last occurrence of a series, without timezone
+ *
+ * @param fcinfo Function call info containing rrule and dtstart timestamp
+ * @return Datum containing tsrange
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_span);
+Datum pg_rrule_span(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Planner Support
+ * ======================================================================== */
+
+/**
+ * pg_rrule_occurrences_support - Row and cost estimates for expansions
+ *
+ * Support function of get_occurrences(), rrule_occurrences() and
+ * rrule_occurrences_batch(). When the rule (and, for the batch variant,
+ * the arrays) are constants, answers SupportRequestRows for the
+ * set-returning variants and SupportRequestCost for all of them from
+ * pg_rrule_estimate_occurrences(), using the DTSTART and window arguments
+ * that are constants as bounds.
+ *
+ * @param fcinfo Function call info containing the support request node
+ * @return The request node, filled in, or NULL to keep the defaults
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurrences_support);
+Datum pg_rrule_occurrences_support(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Expanded Form
+ * ======================================================================== */
+
+/**
+ * pg_rrule_expand - Return a rule in expanded form
+ *
+ * Assigned to a PL/pgSQL variable, the expanded object stays decoded for
+ * as long as the variable holds it, and every accessor called on the
+ * variable reads it without decoding (see pg_rrule_storage.h). It is
+ * flattened again only when stored.
+ *
+ * @param fcinfo Function call info containing rrule argument
+ * @return Datum containing a read-write expanded object pointer
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_expand);
+Datum pg_rrule_expand(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Expansion Cache
+ * ======================================================================== */
+
+/**
+ * pg_rrule_cache_stats - Counters of the expansion cache in this backend
+ *
+ * @param fcinfo Function call info, no arguments
+ * @return Datum containing a (hits, misses, evictions, shared_hits) record
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_cache_stats);
+Datum pg_rrule_cache_stats(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Series Functions
+ * ======================================================================== */
+
+/**
+ * pg_rrule_series_in - Text input function for rrule_series type
+ *
+ * Accepts "DTSTART=<timestamptz>;DURATION=<interval>;<rule>", where the
+ * DURATION part is optional and <rule> is an RRULE as for the rrule type.
+ *
+ * @param fcinfo Function call info containing cstring argument
+ * @return Datum containing the rrule_series varlena
+ * @throws ERROR if any part is malformed or the duration is negative or has months
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_in);
+Datum pg_rrule_series_in(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_out - Text output function for rrule_series type
+ *
+ * @param fcinfo Function call info containing rrule_series argument
+ * @return Datum containing cstring in the format of pg_rrule_series_in()
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_out);
+Datum pg_rrule_series_out(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_send - Binary output function for rrule_series type
+ *
+ * Sends DTSTART and the duration in microseconds as int8, followed by the
+ * rule in the format of pg_rrule_send().
+ *
+ * @param fcinfo Function call info containing rrule_series argument
+ * @return Datum containing bytea with serialized binary data
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_send);
+Datum pg_rrule_series_send(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_recv - Binary input function for rrule_series type
+ *
+ * @param fcinfo Function call info containing internal buffer argument
+ * @return Datum containing the rrule_series varlena
+ * @throws ERROR if the payload is malformed
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_recv);
+Datum pg_rrule_series_recv(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_make - Build a series from a rule, DTSTART and duration
+ *
+ * @param fcinfo Function call info containing rrule, timestamptz and interval
+ * @return Datum containing the rrule_series varlena
+ * @throws ERROR if the duration is negative or has months
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_make);
+Datum pg_rrule_series_make(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_get_rule, pg_rrule_series_get_dtstart, pg_rrule_series_get_duration - Parts of a series
+ *
+ * @param fcinfo Function call info containing rrule_series argument
+ * @return Datum containing the rrule, timestamptz or interval
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_get_rule);
+Datum pg_rrule_series_get_rule(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_get_dtstart);
+Datum pg_rrule_series_get_dtstart(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_get_duration);
+Datum pg_rrule_series_get_duration(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_overlaps - Whether a series has an occurrence overlapping a range
+ *
+ * An occurrence at t covers [t, t + duration), or only t for a zero
+ * duration. Seeks to the start of the range and stops at the first
+ * occurrence past it. This is the && operator and the recheck of the GiST
+ * opclass.
+ *
+ * @param fcinfo Function call info containing rrule_series and tstzrange
+ * @return Datum containing boolean result
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_overlaps);
+Datum pg_rrule_series_overlaps(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_key_in, pg_rrule_series_key_out - I/O functions for the GiST storage type
+ *
+ * rrule_series_key only exists inside indexes; both functions raise an error.
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_key_in);
+Datum pg_rrule_series_key_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_key_out);
+Datum pg_rrule_series_key_out(PG_FUNCTION_ARGS);
+
+/**
+ * GiST support functions for rrule_series_ops
+ *
+ * Keys are pg_rrule_series_key: leaf keys hold the extent of the series,
+ * from pg_rrule_get_span(), and where the rule has one its period. The
+ * consistent function always asks for a recheck.
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_consistent);
+Datum pg_rrule_series_gist_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_union);
+Datum pg_rrule_series_gist_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_compress);
+Datum pg_rrule_series_gist_compress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_penalty);
+Datum pg_rrule_series_gist_penalty(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_picksplit);
+Datum pg_rrule_series_gist_picksplit(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_gist_same);
+Datum pg_rrule_series_gist_same(PG_FUNCTION_ARGS);
+
+/**
+ * BRIN support functions for rrule_series_brin_ops
+ *
+ * Each block range stores the earliest first occurrence and the latest end
+ * of an occurrence of its series, both from pg_rrule_get_span() like the
+ * GiST leaf keys, as two timestamptz values. Ranges whose series have no
+ * occurrences at all store an inverted extent that overlaps nothing.
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_brin_opcinfo);
+Datum pg_rrule_series_brin_opcinfo(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_brin_add_value);
+Datum pg_rrule_series_brin_add_value(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_brin_consistent);
+Datum pg_rrule_series_brin_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_brin_union);
+Datum pg_rrule_series_brin_union(PG_FUNCTION_ARGS);
+
+/* ========================================================================
+ * Statistics
+ * ======================================================================== */
+
+/**
+ * pg_rrule_typanalyze, pg_rrule_series_typanalyze - ANALYZE functions for rrule and rrule_series
+ *
+ * Collect the standard statistics, then add a slot of kind
+ * PG_RRULE_STATISTIC_KIND (see pg_rrule.c for its layout) describing the
+ * sampled rules: fractions of each FREQ, fraction of bounded rules, mean
+ * INTERVAL and quantiles of pg_rrule_estimate_rate() in occurrences per
+ * day. For rrule_series, also quantiles of the first occurrence and of the
+ * end of the last one, and the mean DURATION.
+ *
+ * @param fcinfo Function call info containing the VacAttrStats
+ * @return Datum containing boolean, false if the column can't be analyzed
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_typanalyze);
+Datum pg_rrule_typanalyze(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_series_typanalyze);
+Datum pg_rrule_series_typanalyze(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_series_overlap_sel - Restriction selectivity of rrule_series && tstzrange
+ *
+ * The fraction of series active during the range, from the quantiles of
+ * their extent, times the chance that one of their occurrences falls in
+ * it, from the quantiles of their rate, the length of the range and the
+ * mean DURATION. Falls back to the default of contsel without statistics.
+ *
+ * @param fcinfo Function call info containing planner info, operator, arguments and varRelid
+ * @return Datum containing float8 selectivity
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_series_overlap_sel);
+Datum pg_rrule_series_overlap_sel(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_occurs_at_support - Selectivity of rrule_occurs_at()
+ *
+ * Answers SupportRequestSelectivity when the rule is a column with
+ * statistics: the chance that a rule of the column has an occurrence at
+ * a given second, from the quantiles of its rate.
+ *
+ * @param fcinfo Function call info containing the support request node
+ * @return The request node, filled in, or NULL to keep the default
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_occurs_at_support);
+Datum pg_rrule_occurs_at_support(PG_FUNCTION_ARGS);
+
 /* ========================================================================
  * Comparison Operators
  * ======================================================================== */
 
+/*
+ * All comparisons work on the canonical byte form of the rule (see
+ * pg_rrule_canonical()), so two rules are equal exactly when they have the
+ * same FREQ, COUNT, INTERVAL, UNTIL, WKST, RSCALE and BY* lists. The order
+ * is a total order for btree indexes, GROUP BY and DISTINCT; it sorts by
+ * FREQ first and is otherwise not meaningful.
+ */
+
 /**
  * pg_rrule_eq - Equality operator for rrule type
  *
- * Compares two RRULE values for equality by comparing their string
- * representations. Two RRULEs are considered equal if they generate
- * the same recurrence pattern.
- *
  * @param fcinfo Function call info containing two rrule arguments
  * @return Datum containing boolean result of equality comparison
  */
@@ -152,15 +706,59 @@ Datum pg_rrule_eq(PG_FUNCTION_ARGS);
 /**
  * pg_rrule_ne - Inequality operator for rrule type
  *
- * Compares two RRULE values for inequality. Returns the logical
- * negation of the equality operator.
- *
  * @param fcinfo Function call info containing two rrule arguments
  * @return Datum containing boolean result of inequality comparison
  */
 PG_FUNCTION_INFO_V1(pg_rrule_ne);
 Datum pg_rrule_ne(PG_FUNCTION_ARGS);
 
+/**
+ * pg_rrule_lt, pg_rrule_le, pg_rrule_gt, pg_rrule_ge - Ordering operators for rrule type
+ *
+ * @param fcinfo Function call info containing two rrule arguments
+ * @return Datum containing boolean result of the comparison
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_lt);
+Datum pg_rrule_lt(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_le);
+Datum pg_rrule_le(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_gt);
+Datum pg_rrule_gt(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_rrule_ge);
+Datum pg_rrule_ge(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_cmp - Btree support function for rrule type
+ *
+ * @param fcinfo Function call info containing two rrule arguments
+ * @return Datum containing int4 -1, 0 or 1
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_cmp);
+Datum pg_rrule_cmp(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_hash - Hash support function for rrule type
+ *
+ * @param fcinfo Function call info containing an rrule argument
+ * @return Datum containing int4 hash of the canonical bytes
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_hash);
+Datum pg_rrule_hash(PG_FUNCTION_ARGS);
+
+/**
+ * pg_rrule_hash_extended - Seeded hash support function for rrule type
+ *
+ * Used for hash partitioning.
+ *
+ * @param fcinfo Function call info containing an rrule argument and an int8 seed
+ * @return Datum containing int8 hash of the canonical bytes
+ */
+PG_FUNCTION_INFO_V1(pg_rrule_hash_extended);
+Datum pg_rrule_hash_extended(PG_FUNCTION_ARGS);
+
 /* ========================================================================
  * Property Accessor Functions
  * ======================================================================== */
@@ -354,6 +952,279 @@ Datum pg_rrule_get_wkst(PG_FUNCTION_ARGS);
  * Internal Helper Functions
  * ======================================================================== */
 
+/**
+ * pg_rrule_native_engine - Value of the pg_rrule.native_engine setting
+ *
+ * When off, every rule is expanded by libical; useful to compare both.
+ */
+extern bool pg_rrule_native_engine;
+
+/**
+ * _PG_init - Module load callback, defines the pg_rrule.* settings
+ */
+void _PG_init(void);
+
+/**
+ * Number of occurrences converted together by pg_rrule_iterator_next_batch()
+ */
+#define PG_RRULE_BATCH_SIZE 256
+
+/**
+ * pg_rrule_iterator - Incremental occurrence iterator
+ *
+ * Bundles a libical iterator with the rule it reads from, the zone of
+ * DTSTART and an optional upper bound, so occurrences can be pulled one at
+ * a time instead of being materialized up front. Rules the native engine
+ * can compile are enumerated by it instead (`native`), unless
+ * pg_rrule.native_engine is off.
+ *
+ * `limit` caps the number of occurrences produced (0 for no cap) and may be
+ * set by the caller after pg_rrule_iterator_init().
+ *
+ * Every iterator is bounded by pg_rrule.max_occurrences and checks for
+ * interrupts as it goes. Callers whose result is persisted or must agree
+ * with persisted data (series extents, index keys, the && recheck) set
+ * `unlimited` after pg_rrule_iterator_init(), so a session setting can't
+ * change what they compute. The libical iterator, allocated with malloc, is
+ * tied to the memory context current at pg_rrule_iterator_init() (`guard`),
+ * so it is freed when that context goes away, on error included.
+ *
+ * The libical iterator keeps a pointer to `recurrence`, whose BY* arrays in
+ * turn point into memory set up by flatten_to_tmp(). Both must
+ * outlive the iterator, and the struct itself must not be moved after
+ * pg_rrule_iterator_init().
+ */
+typedef struct pg_rrule_iterator {
+    struct icalrecurrencetype recurrence;
+    icalrecur_iterator *recur_iterator;
+    struct pg_rrule_ical_guard *guard;
+    bool native;
+    pg_rrule_engine engine;
+    icaltimezone *zone;
+    pg_rrule_epoch_cache epochs;
+    struct icaltimetype dtstart;
+    struct icaltimetype from;
+    struct icaltimetype until;
+    int64 limit;
+    int64 produced;
+    bool unlimited;
+    bool done;
+} pg_rrule_iterator;
+
+/**
+ * pg_rrule_iterator_init - Set up an occurrence iterator
+ *
+ * @param iter Iterator state to initialize
+ * @param recurrence The icalrecurrencetype structure (copied into iter)
+ * @param dtstart Starting date/time for the recurrence
+ * @param until Ending date/time to limit occurrences, or null time for none
+ * @throws ERROR if libical can't create an iterator for the rule
+ */
+void pg_rrule_iterator_init(pg_rrule_iterator *iter,
+                            struct icalrecurrencetype recurrence,
+                            struct icaltimetype dtstart,
+                            struct icaltimetype until);
+
+/**
+ * pg_rrule_iterator_seek - Skip to the first occurrence at or after `from`
+ *
+ * Uses icalrecur_iterator_set_start() to jump directly to `from` when the
+ * rule allows it. COUNT-bounded rules have to be walked from dtstart so
+ * their occurrences are numbered correctly; for those (and whenever libical
+ * refuses to seek) the earlier occurrences are skipped while iterating.
+ * Must be called before the first pg_rrule_iterator_next().
+ *
+ * @param iter Iterator state
+ * @param from Lower bound (inclusive) for produced occurrences
+ */
+void pg_rrule_iterator_seek(pg_rrule_iterator *iter, struct icaltimetype from);
+
+/**
+ * pg_rrule_iterator_next - Fetch the next occurrence
+ *
+ * @param iter Iterator state
+ * @param out Output parameter for the occurrence as seconds since epoch
+ * @return true if an occurrence was produced, false once the series or the
+ *         until bound is exhausted, or pg_rrule.max_occurrences is reached
+ *         with pg_rrule.limit_action = truncate
+ * @throws ERROR when pg_rrule.max_occurrences is reached with
+ *         pg_rrule.limit_action = error, or on query cancel
+ */
+bool pg_rrule_iterator_next(pg_rrule_iterator *iter, pg_time_t *out);
+
+/**
+ * pg_rrule_iterator_next_batch - Fetch up to `n` occurrences at once
+ *
+ * Occurrences are generated as civil times first and converted to epoch
+ * seconds in one pass, see pg_rrule_civil_to_epoch_batch().
+ *
+ * @param iter Iterator state
+ * @param out Output array for the occurrences as seconds since epoch
+ * @param n Capacity of `out`, at most PG_RRULE_BATCH_SIZE
+ * @return Number of occurrences produced, less than `n` only at the end
+ */
+int pg_rrule_iterator_next_batch(pg_rrule_iterator *iter, pg_time_t *out, int n);
+
+/**
+ * pg_rrule_iterator_free - Release the libical iterator, if any
+ *
+ * Safe to call more than once.
+ *
+ * @param iter Iterator state
+ */
+void pg_rrule_iterator_free(pg_rrule_iterator *iter);
+
+/**
+ * pg_rrule_build_occurrence_array - Drain an iterator into a timestamp array
+ *
+ * Writes occurrences straight into the payload of the resulting ArrayType,
+ * growing it geometrically, so the whole expansion is a single pass over a
+ * single allocation.
+ *
+ * @param iter Initialized occurrence iterator
+ * @param element_type TIMESTAMPOID or TIMESTAMPTZOID
+ * @return 1-D array of the occurrences (empty array if there are none)
+ * @throws ERROR if the result would exceed the maximum allocation size, or
+ *         pg_rrule.max_expansion_memory unless pg_rrule.limit_action is
+ *         truncate
+ */
+ArrayType *pg_rrule_build_occurrence_array(pg_rrule_iterator *iter, Oid element_type);
+
+/**
+ * pg_rrule_arith - Closed-form description of a fixed-step rule
+ *
+ * Occurrence k of the series is at civil second `start + k * step`, in the
+ * zone of DTSTART, for 0 <= k <= last_index (or without end if !bounded).
+ * A bounded series with last_index < 0 has no occurrences at all.
+ */
+typedef struct pg_rrule_arith {
+    int64 start;
+    int64 step;
+    bool bounded;
+    int64 last_index;
+} pg_rrule_arith;
+
+/**
+ * pg_rrule_arith_init - Describe a rule in closed form if possible
+ *
+ * Only rules that are a pure FREQ/INTERVAL step qualify: SECONDLY to WEEKLY,
+ * no BY* parts, no RSCALE and no date-only UNTIL. Iteration is done in the
+ * civil (wall clock) time of DTSTART's zone, same as libical does.
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @param dtstart Starting date/time for the recurrence
+ * @param arith Output parameter for the closed-form description
+ * @return true if the rule could be described, false if it must be iterated
+ */
+bool pg_rrule_arith_init(const struct icalrecurrencetype *recurrence,
+                         struct icaltimetype dtstart,
+                         pg_rrule_arith *arith);
+
+/**
+ * pg_rrule_arith_count - Count closed-form occurrences inside [lo, hi]
+ *
+ * @param arith Closed-form description from pg_rrule_arith_init()
+ * @param lo Lower bound (inclusive) as civil seconds
+ * @param hi Upper bound (inclusive) as civil seconds
+ * @return Number of occurrences inside the bounds
+ */
+int64 pg_rrule_arith_count(const pg_rrule_arith *arith, int64 lo, int64 hi);
+
+/**
+ * pg_rrule_match - Result of deciding membership without iterating
+ */
+typedef enum pg_rrule_match {
+    PG_RRULE_MATCH_NO,
+    PG_RRULE_MATCH_YES,
+    PG_RRULE_MATCH_UNKNOWN
+} pg_rrule_match;
+
+/**
+ * pg_rrule_match_fast - Decide whether `tt` is an occurrence from the rule alone
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @param dtstart Starting date/time for the recurrence
+ * @param tt Candidate date/time, in the same zone as dtstart and not before it
+ * @return PG_RRULE_MATCH_UNKNOWN if the rule uses parts that need iteration
+ */
+pg_rrule_match pg_rrule_match_fast(const struct icalrecurrencetype *recurrence,
+                                   struct icaltimetype dtstart,
+                                   struct icaltimetype tt);
+
+/**
+ * pg_rrule_get_span - First and last occurrence of a series
+ *
+ * Walks the series regardless of pg_rrule.max_occurrences, as the span
+ * feeds stored index keys and statistics; it only stops on query cancel.
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @param dtstart Starting date/time for the recurrence
+ * @param first Output parameter for the first occurrence
+ * @param bounded Output parameter, false if the series never ends
+ * @param last Output parameter for the last occurrence, set if bounded
+ * @return false if the series has no occurrences at all
+ */
+bool pg_rrule_get_span(const struct icalrecurrencetype *recurrence,
+                       struct icaltimetype dtstart,
+                       pg_time_t *first,
+                       bool *bounded,
+                       pg_time_t *last);
+
+/**
+ * pg_rrule_estimate_rate - Estimated number of occurrences per second
+ *
+ * The long-run rate behind pg_rrule_estimate_occurrences(), ignoring
+ * UNTIL and COUNT. Also collected by ANALYZE, see pg_rrule_typanalyze().
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @return Occurrences per second, 0 for an unsupported FREQ
+ */
+double pg_rrule_estimate_rate(const struct icalrecurrencetype *recurrence);
+
+/**
+ * pg_rrule_estimate_occurrences - Estimated number of occurrences between two bounds
+ *
+ * Derived from FREQ, INTERVAL and the cardinality of the BY* parts alone,
+ * without iterating, then bounded by the rule's UNTIL and COUNT. Meant for
+ * the planner: cheap, and right to within a small factor for ordinary
+ * rules.
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @param lower Earliest occurrence (DTSTART or window start), or DT_NOBEGIN if unknown
+ * @param upper Latest occurrence (window end), or DT_NOEND if unknown
+ * @return Estimated number of occurrences, at least 1; for series without
+ *         bounds, pg_rrule.max_occurrences (or 1000000 if that is 0)
+ */
+double pg_rrule_estimate_occurrences(const struct icalrecurrencetype *recurrence,
+                                     TimestampTz lower,
+                                     TimestampTz upper);
+
+/**
+ * pg_rrule_get_session_timezone - Resolve the session timezone for libical
+ *
+ * Maps the PostgreSQL session timezone to libical's built-in zone of the
+ * same name, which carries the full DST rules. Zones libical doesn't know
+ * are matched by their fixed UTC offset, falling back to UTC (with a
+ * WARNING) when even that fails.
+ *
+ * The result is cached per backend and resolved again only when the
+ * TimeZone setting changes.
+ *
+ * @return libical timezone, never NULL
+ */
+icaltimezone *pg_rrule_get_session_timezone(void);
+
+/**
+ * pg_rrule_get_named_timezone - Resolve an IANA zone name for libical
+ *
+ * The last zone looked up is cached per backend.
+ *
+ * @param name Zone name, e.g. "Europe/Berlin"
+ * @return libical timezone, never NULL
+ * @throws ERROR if the zone name is not known
+ */
+icaltimezone *pg_rrule_get_named_timezone(const text *name);
+
 /**
  * pg_rrule_get_occurrences - Internal occurrence generation helper
  *
@@ -387,38 +1258,23 @@ Datum pg_rrule_get_occurrences_until(struct icalrecurrencetype recurrence,
                                            bool use_tz);
 
 /**
- * pg_rrule_rrule_to_time_t_array - Convert RRULE to time_t array
- *
- * Low-level function that generates occurrences as an array of time_t values.
- * Used internally by the higher-level occurrence generation functions.
- *
- * @param recurrence The icalrecurrencetype structure
- * @param dtstart Starting date/time for the recurrence
- * @param out_array Output parameter for allocated time_t array
- * @param out_count Output parameter for number of occurrences generated
- */
-void pg_rrule_rrule_to_time_t_array(struct icalrecurrencetype recurrence,
-                                    struct icaltimetype dtstart,
-                                    time_t** const out_array,
-                                    unsigned int* const out_count);
-
-/**
- * pg_rrule_rrule_to_time_t_array_until - Convert RRULE to bounded time_t array
+ * pg_rrule_get_occurrences_between - Internal windowed occurrence generation helper
  *
- * Low-level function that generates occurrences within a time range
- * as an array of time_t values.
+ * Core function for generating the recurrence occurrences that fall inside
+ * [from, until], seeking to `from` rather than iterating from dtstart.
  *
  * @param recurrence The icalrecurrencetype structure
  * @param dtstart Starting date/time for the recurrence
- * @param until Ending date/time to limit occurrences
- * @param out_array Output parameter for allocated time_t array
- * @param out_count Output parameter for number of occurrences generated
+ * @param from Start of the window, or null time for none
+ * @param until End of the window, or null time for none
+ * @param use_tz Whether to preserve timezone information
+ * @return Datum containing array of timestamp values within the window
  */
-void pg_rrule_rrule_to_time_t_array_until(struct icalrecurrencetype recurrence,
-                                          struct icaltimetype dtstart,
-                                          struct icaltimetype until,
-                                          time_t** const out_array,
-                                          unsigned int* const out_count);
+Datum pg_rrule_get_occurrences_between(struct icalrecurrencetype recurrence,
+                                       struct icaltimetype dtstart,
+                                       struct icaltimetype from,
+                                       struct icaltimetype until,
+                                       bool use_tz);
 
 /**
  * pg_rrule_get_bypart - Generic BY* property extractor
@@ -435,51 +1291,38 @@ void pg_rrule_rrule_to_time_t_array_until(struct icalrecurrencetype recurrence,
 Datum pg_rrule_get_bypart(struct icalrecurrencetype *recurrence_ref, icalrecurrencetype_byrule part, size_t max_size);
 
 /**
- * @brief Helper function to convert flattened PostgreSQL storage format to temporary struct with real pointers.
- *
- * This function converts the internal flattened storage format used by the PostgreSQL rrule type
- * back into a standard icalrecurrencetype struct with real memory pointers. The flattened format
- * stores all data in a single contiguous memory block using offsets instead of pointers to ensure
- * compatibility with PostgreSQL's direct memory storage mechanism.
- *
- * @details
- * The PostgreSQL rrule type uses a flattened storage format where:
- * - The base icalrecurrencetype struct is stored first
- * - All by-rule arrays (by[].data) are stored as offsets from VARDATA base address
- * - The rscale string is stored as an offset from VARDATA base address
- * - This prevents pointer corruption when PostgreSQL stores/loads data directly to/from disk
+ * @brief Helper function to convert stored rrule values to a struct with real pointers.
  *
- * This function reconstructs a temporary struct with real pointers by:
- * 1. Copying the base structure fields
- * 2. Converting stored offsets back to real memory pointers for by-rule arrays
- * 3. Converting stored offset back to real memory pointer for rscale string
+ * Decodes the on-disk representation of the rrule type (see pg_rrule_storage.h)
+ * into a standard icalrecurrencetype struct usable with libical functions.
+ * Both the current compact format and the legacy flattened format, a copy of
+ * the struct with offsets instead of pointers, are accepted.
  *
- * @param varlena_data Pointer to the PostgreSQL varlena structure containing flattened rrule data.
- *                     This should be obtained from PG_GETARG_POINTER() in PostgreSQL functions.
- *                     The data layout is: [VARHDRSZ][icalrecurrencetype][by_arrays][rscale_string]
+ * @param varlena_data Pointer to the PostgreSQL varlena structure containing the rrule data.
+ *                     This should be obtained from PG_GETARG_RRULE_P() in PostgreSQL functions;
+ *                     short varlena headers and expanded objects are accepted.
  *
  * @param tmp Pointer to a temporary icalrecurrencetype struct that will be populated
  *                    with the converted data. This struct should be allocated on the stack
  *                    by the caller and will contain real pointers suitable for use with
  *                    libical functions.
  *
- * @note The tmp will contain pointers that reference memory within the original
- *       varlena_data buffer. The caller must ensure that varlena_data remains valid
- *       for the lifetime of tmp usage.
- *
- * @note This function does not allocate any new memory. All pointers in tmp
- *       point directly into the varlena_data buffer.
+ * @note The pointers in tmp reference memory allocated in the current memory context,
+ *       or for an expanded object the object's own. The caller must ensure that it
+ *       remains valid for the lifetime of tmp usage.
  *
  * @warning Do not attempt to free or modify the data pointed to by tmp fields.
  *          The memory is managed by PostgreSQL's memory context system.
  *
+ * @throws ERROR if the stored value is malformed
+ *
  * @example
  * ```c
  * Datum my_rrule_function(PG_FUNCTION_ARGS) {
- *     char *varlena_data = (char*) PG_GETARG_POINTER(0);
+ *     char *varlena_data = (char*) PG_GETARG_RRULE_P(0);
  *     struct icalrecurrencetype tmp;
  *
- *     // Convert flattened format to usable struct
+ *     // Convert stored format to usable struct
  *     flatten_to_tmp(varlena_data, &tmp);
  *
  *     // Now tmp can be used with libical functions
@@ -491,14 +1334,24 @@ Datum pg_rrule_get_bypart(struct icalrecurrencetype *recurrence_ref, icalrecurre
  * }
  * ```
  *
- * @see pg_rrule_in() for the function that creates the flattened format
+ * @see pg_rrule_in() for the function that creates the stored format
  * @see pg_rrule_out() for example usage of this helper function
- * @see PostgreSQL documentation on VARIABLE length types
- *
- * @since This helper function is required due to the flattened storage format
- *        implemented to solve pointer corruption issues with PostgreSQL's
- *        direct memory storage mechanism.
  */
 void flatten_to_tmp(char *varlena_data, struct icalrecurrencetype *tmp);
 
+/**
+ * pg_rrule_recv_legacy - Read the binary format of earlier versions
+ *
+ * That format sends every field of struct icalrecurrencetype as a separate
+ * big-endian integer, starting with the refcount, so its first byte is
+ * never PG_RRULE_FORMAT_V2. Every field is checked as pg_rrule_decode()
+ * checks stored ones, see pg_rrule_validate(), and UNTIL must be a valid
+ * date and time.
+ *
+ * @param buf Message buffer positioned at the start of the value
+ * @param tmp Output parameter for the received rule
+ * @throws ERROR if the message is short or a field is out of range
+ */
+void pg_rrule_recv_legacy(StringInfo buf, struct icalrecurrencetype *tmp);
+
 #endif // PG_RRULE_H
@@ -0,0 +1,195 @@
+#include "pg_rrule_cache.h"
+#include "pg_rrule_storage.h"
+#include "pg_rrule_shared_cache.h"
+#include "pg_rrule_limits.h"
+
+#include <lib/ilist.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <pgtime.h>
+#if PG_VERSION_NUM >= 140000
+#include <common/hashfn.h>
+#else
+#include <utils/hashutils.h>
+#endif
+
+int pg_rrule_cache_size = 256;
+
+uint64 pg_rrule_cache_hits = 0;
+uint64 pg_rrule_cache_misses = 0;
+uint64 pg_rrule_cache_evictions = 0;
+
+typedef struct pg_rrule_cache_entry {
+    dlist_node node;
+    uint32 hash;
+    Size key_len;
+    Size result_len;
+    char data[FLEXIBLE_ARRAY_MEMBER];   /* key, then result */
+} pg_rrule_cache_entry;
+
+typedef struct pg_rrule_cache {
+    dlist_head lru;                     /* most recently used first */
+    int nentries;
+    Size used;                          /* bytes of all entries */
+    StringInfoData key;                 /* key of the last lookup */
+    uint32 hash;
+} pg_rrule_cache;
+
+#define PG_RRULE_CACHE_ENTRY_SIZE(key_len, result_len) \
+    (offsetof(pg_rrule_cache_entry, data) + (key_len) + (result_len))
+
+/* Helpers */
+static pg_rrule_cache *pg_rrule_cache_get(FmgrInfo *flinfo) {
+    pg_rrule_cache *cache = (pg_rrule_cache *) flinfo->fn_extra;
+    if (cache == NULL) {
+        cache = MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(pg_rrule_cache));
+        dlist_init(&cache->lru);
+
+        MemoryContext old_context = MemoryContextSwitchTo(flinfo->fn_mcxt);
+        initStringInfo(&cache->key);
+        MemoryContextSwitchTo(old_context);
+
+        flinfo->fn_extra = cache;
+    }
+    return cache;
+}
+
+static void pg_rrule_cache_evict(pg_rrule_cache *cache) {
+    pg_rrule_cache_entry *entry = dlist_container(pg_rrule_cache_entry, node, dlist_tail_node(&cache->lru));
+    dlist_delete(&entry->node);
+    cache->nentries--;
+    cache->used -= PG_RRULE_CACHE_ENTRY_SIZE(entry->key_len, entry->result_len);
+    pfree(entry);
+    pg_rrule_cache_evictions++;
+}
+
+static void pg_rrule_cache_build_key(pg_rrule_cache *cache, FunctionCallInfo fcinfo, int flags) {
+    StringInfo key = &cache->key;
+    resetStringInfo(key);
+
+    // Keys of the shared cache are not per call site; the function and its database tell results apart
+    const Oid function[2] = {MyDatabaseId, fcinfo->flinfo->fn_oid};
+    appendBinaryStringInfo(key, (const char *) function, sizeof(function));
+
+    const int ntimestamps = fcinfo->nargs - 1 - ((flags & PG_RRULE_CACHE_ZONE_ARG) ? 1 : 0);
+    for (int i = 1; i <= ntimestamps; i++) {
+        const int64 value = DatumGetInt64(PG_GETARG_DATUM(i));
+        appendBinaryStringInfo(key, (const char *) &value, sizeof(value));
+    }
+
+    // A call failing or truncated under the current limits must not hit a result made under looser ones
+    const int32 limits[3] = {pg_rrule_max_occurrences, pg_rrule_max_expansion_memory, pg_rrule_limit_action_setting};
+    appendBinaryStringInfo(key, (const char *) limits, sizeof(limits));
+
+    // By name rather than pg_tz pointer, so that keys mean the same in every backend
+    if (flags & PG_RRULE_CACHE_SESSION_TZ) {
+        const char *tz_name = pg_get_timezone_name(session_timezone);
+        appendStringInfoString(key, tz_name);
+        appendStringInfoChar(key, '\0');
+    }
+
+    if (flags & PG_RRULE_CACHE_ZONE_ARG) {
+        const text *zone = PG_GETARG_TEXT_PP(fcinfo->nargs - 1);
+        const int32 zone_len = VARSIZE_ANY_EXHDR(zone);
+        appendBinaryStringInfo(key, (const char *) &zone_len, sizeof(zone_len));
+        appendBinaryStringInfo(key, VARDATA_ANY(zone), zone_len);
+    }
+
+    Size rule_len;
+    const char *rule = pg_rrule_canonical(PG_GETARG_RRULE_P(0), &rule_len);
+    appendBinaryStringInfo(key, rule, (int) rule_len);
+
+    cache->hash = DatumGetUInt32(hash_any((const unsigned char *) key->data, key->len));
+}
+
+static void pg_rrule_cache_insert(pg_rrule_cache *cache, FmgrInfo *flinfo, const char *result, Size result_len) {
+    const Size limit = (Size) pg_rrule_cache_size * 1024;
+    const Size key_len = cache->key.len;
+    const Size size = PG_RRULE_CACHE_ENTRY_SIZE(key_len, result_len);
+    if (size > limit) {
+        return;
+    }
+
+    while (cache->nentries > 0 && (cache->nentries >= PG_RRULE_CACHE_MAX_ENTRIES || cache->used + size > limit)) {
+        pg_rrule_cache_evict(cache);
+    }
+
+    pg_rrule_cache_entry *entry = MemoryContextAlloc(flinfo->fn_mcxt, size);
+    entry->hash = cache->hash;
+    entry->key_len = key_len;
+    entry->result_len = result_len;
+    memcpy(entry->data, cache->key.data, key_len);
+    memcpy(entry->data + key_len, result, result_len);
+
+    dlist_push_head(&cache->lru, &entry->node);
+    cache->nentries++;
+    cache->used += size;
+}
+
+bool pg_rrule_cache_lookup(FunctionCallInfo fcinfo, int flags, Datum *result) {
+    const bool local = pg_rrule_cache_size > 0;
+
+    if (!local && fcinfo->flinfo->fn_extra != NULL) {
+        // Disabled since the last call; give the memory back
+        pg_rrule_cache *cache = (pg_rrule_cache *) fcinfo->flinfo->fn_extra;
+        while (cache->nentries > 0) {
+            pg_rrule_cache_evict(cache);
+        }
+    }
+
+    if (!local && !pg_rrule_shared_cache_enabled()) {
+        return false;
+    }
+
+    pg_rrule_cache *cache = pg_rrule_cache_get(fcinfo->flinfo);
+    pg_rrule_cache_build_key(cache, fcinfo, flags);
+
+    dlist_iter iter;
+    dlist_foreach(iter, &cache->lru) {
+        pg_rrule_cache_entry *entry = dlist_container(pg_rrule_cache_entry, node, iter.cur);
+        if (entry->hash != cache->hash || entry->key_len != (Size) cache->key.len ||
+            memcmp(entry->data, cache->key.data, entry->key_len) != 0) {
+            continue;
+        }
+
+        dlist_move_head(&cache->lru, &entry->node);
+
+        // The caller may scribble on or free its result; hand out a copy
+        char *copy = palloc(entry->result_len);
+        memcpy(copy, entry->data + entry->key_len, entry->result_len);
+        *result = PointerGetDatum(copy);
+
+        pg_rrule_cache_hits++;
+        return true;
+    }
+
+    char *shared_result;
+    Size shared_result_len;
+    if (pg_rrule_shared_cache_lookup(cache->key.data, cache->key.len, &shared_result, &shared_result_len)) {
+        if (local) {
+            pg_rrule_cache_insert(cache, fcinfo->flinfo, shared_result, shared_result_len);
+        }
+        *result = PointerGetDatum(shared_result);
+        return true;
+    }
+
+    pg_rrule_cache_misses++;
+    return false;
+}
+
+Datum pg_rrule_cache_store(FunctionCallInfo fcinfo, Datum result) {
+    pg_rrule_cache *cache = (pg_rrule_cache *) fcinfo->flinfo->fn_extra;
+    if (cache == NULL || VARATT_IS_EXTENDED(DatumGetPointer(result))) {
+        return result;
+    }
+
+    const char *data = DatumGetPointer(result);
+    const Size len = VARSIZE(data);
+
+    if (pg_rrule_cache_size > 0) {
+        pg_rrule_cache_insert(cache, fcinfo->flinfo, data, len);
+    }
+    pg_rrule_shared_cache_store(cache->key.data, cache->key.len, data, len);
+
+    return result;
+}
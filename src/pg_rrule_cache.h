@@ -0,0 +1,62 @@
+#ifndef PG_RRULE_CACHE_H
+#define PG_RRULE_CACHE_H
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* ========================================================================
+ * Expansion Cache
+ *
+ * Joins such as `events JOIN calendars ... get_occurrences(c.rule, c.start,
+ * window)` call the array functions with the same arguments over and over.
+ * Each call site (FmgrInfo) keeps the last few results in fn_extra, under
+ * fn_mcxt, and hands out copies of them on a repeated call. The key is the
+ * function, the raw remaining arguments and the canonical rule, so it holds
+ * for every rule however it was stored. Entries are evicted least recently used
+ * first once pg_rrule.cache_size is exceeded. Misses fall through to the
+ * shared cache of pg_rrule_shared_cache.h, when it is enabled.
+ * ======================================================================== */
+
+/* Most entries kept per call site, whatever their size */
+#define PG_RRULE_CACHE_MAX_ENTRIES 32
+
+/* The result depends on the session's TimeZone */
+#define PG_RRULE_CACHE_SESSION_TZ 0x01
+/* The last argument is a zone name (text), every other one a timestamp */
+#define PG_RRULE_CACHE_ZONE_ARG 0x02
+
+/**
+ * pg_rrule_cache_size - Value of the pg_rrule.cache_size setting, in kB
+ *
+ * Memory each call site may use for cached results; 0 disables the cache.
+ */
+extern int pg_rrule_cache_size;
+
+/* Backend-local counters, reported by rrule_cache_stats(); hits of the shared cache are not counted here */
+extern uint64 pg_rrule_cache_hits;
+extern uint64 pg_rrule_cache_misses;
+extern uint64 pg_rrule_cache_evictions;
+
+/**
+ * pg_rrule_cache_lookup - Look up the result of a call
+ *
+ * The key of the call is remembered, so that a miss must be followed by
+ * pg_rrule_cache_store() once the result is computed.
+ *
+ * @param fcinfo Call of an array function taking an rrule first
+ * @param flags PG_RRULE_CACHE_* bits describing the remaining arguments
+ * @param result Output parameter for a copy of the cached result
+ * @return true on a hit
+ */
+bool pg_rrule_cache_lookup(FunctionCallInfo fcinfo, int flags, Datum *result);
+
+/**
+ * pg_rrule_cache_store - Remember the result of the call looked up last
+ *
+ * @param fcinfo Same call as given to pg_rrule_cache_lookup()
+ * @param result Flat varlena result of the call
+ * @return `result`, unchanged
+ */
+Datum pg_rrule_cache_store(FunctionCallInfo fcinfo, Datum result);
+
+#endif // PG_RRULE_CACHE_H
@@ -0,0 +1,667 @@
+#include "pg_rrule_engine.h"
+
+#include <datatype/timestamp.h>
+#include <miscadmin.h>
+#include <port/pg_bitutils.h>
+
+#define PG_RRULE_ALL_SECONDS ((UINT64CONST(1) << 60) - 1)
+#define PG_RRULE_ALL_MINUTES ((UINT64CONST(1) << 60) - 1)
+#define PG_RRULE_ALL_HOURS (((uint32) 1 << 24) - 1)
+#define PG_RRULE_ALL_WEEKDAYS 0x7F
+#define PG_RRULE_ALL_MONTHS 0x1FFE
+
+/* Helpers */
+static int64 pg_rrule_mod(int64 a, int64 b) {
+    const int64 r = a % b;
+    return r < 0 ? r + b : r;
+}
+
+/* 1970-01-01 was a Thursday; ICAL_SUNDAY_WEEKDAY == 1 */
+static int pg_rrule_weekday(int64 days) {
+    return (int) pg_rrule_mod(days + 4, 7) + 1;
+}
+
+/* Number of the week containing `days`, weeks beginning on `week_start` */
+static int64 pg_rrule_week(int64 days, int week_start) {
+    return pg_rrule_floor_div(days + 5 - week_start, 7);
+}
+
+static bool pg_rrule_bit_test(const uint64 *set, int n) {
+    return (set[n >> 6] >> (n & 63)) & 1;
+}
+
+static void pg_rrule_bit_set(uint64 *set, int n) {
+    set[n >> 6] |= UINT64CONST(1) << (n & 63);
+}
+
+/* Bits i in [0, width) such that (first + i - base) is a multiple of interval */
+static uint64 pg_rrule_aligned_mask(int64 base, int64 first, int width, int interval) {
+    uint64 mask = 0;
+    for (int64 i = pg_rrule_mod(base - first, interval); i < width; i += interval) {
+        mask |= UINT64CONST(1) << i;
+    }
+    return mask;
+}
+
+/* Compiles a BY* part holding plain values in [min, max] into a mask */
+static bool pg_rrule_compile_part(const struct icalrecurrencetype *recurrence, icalrecurrencetype_byrule part, int min, int max, uint64 *mask) {
+    *mask = 0;
+    for (int i = 0; i < recurrence->by[part].size; i++) {
+        const int value = recurrence->by[part].data[i];
+        if (value < min || value > max) {
+            return false;
+        }
+        *mask |= UINT64CONST(1) << value;
+    }
+    return true;
+}
+
+static void pg_rrule_civil_from_days(int64 days, int *year, int *month, int *day) {
+    // Inverse of pg_rrule_days_from_civil()
+    days += 719468;
+    const int64 era = (days >= 0 ? days : days - 146096) / 146097;
+    const int doe = (int) (days - era * 146097);
+    const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int mp = (5 * doy + 2) / 153;
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = (int) (yoe + era * 400) + (*month <= 2);
+}
+
+/* Days of a month selected by BYMONTHDAY, BYDAY and BYYEARDAY; bit n is day n */
+static uint32 pg_rrule_day_mask(const pg_rrule_compiled *compiled, int year, int month, int64 first_day) {
+    const int days_in_month = icaltime_days_in_month(month, year);
+    uint32 mask = days_in_month == 31 ? 0xFFFFFFFE : (((uint32) 1 << (days_in_month + 1)) - 1) & ~(uint32) 1;
+
+    if (compiled->has_monthdays) {
+        uint32 monthdays = compiled->monthdays;
+        uint32 negative = compiled->monthdays_neg;
+        while (negative != 0) {
+            const int n = pg_rightmost_one_pos32(negative);
+            negative &= negative - 1;
+            if (n <= days_in_month) {
+                monthdays |= (uint32) 1 << (days_in_month - n + 1);
+            }
+        }
+        mask &= monthdays;
+    }
+
+    if (compiled->weekdays != PG_RRULE_ALL_WEEKDAYS) {
+        // The weekday pattern of the month repeats every 7 days from the 1st
+        const int first_weekday = pg_rrule_weekday(first_day);
+        uint32 weekday_mask = 0;
+        for (int d = 1; d <= 7; d++) {
+            const int weekday = (first_weekday + d - 2) % 7 + 1;
+            if ((compiled->weekdays >> (weekday - 1)) & 1) {
+                for (int dd = d; dd <= 31; dd += 7) {
+                    weekday_mask |= (uint32) 1 << dd;
+                }
+            }
+        }
+        mask &= weekday_mask;
+    }
+
+    if (compiled->has_yeardays && mask != 0) {
+        const int year_offset = (int) (first_day - pg_rrule_days_from_civil(year, 1, 1));
+        const int days_in_year = icaltime_is_leap_year(year) ? 366 : 365;
+        uint32 candidates = mask;
+        mask = 0;
+        while (candidates != 0) {
+            const int d = pg_rightmost_one_pos32(candidates);
+            candidates &= candidates - 1;
+
+            const int yearday = year_offset + d;
+            if (pg_rrule_bit_test(compiled->yeardays, yearday) ||
+                pg_rrule_bit_test(compiled->yeardays_neg, days_in_year - yearday + 1)) {
+                mask |= (uint32) 1 << d;
+            }
+        }
+    }
+
+    return mask;
+}
+
+/* INTERVAL for MONTHLY and YEARLY rules */
+static bool pg_rrule_month_aligned(const pg_rrule_compiled *compiled, int year, int month) {
+    switch (compiled->freq) {
+        case ICAL_MONTHLY_RECURRENCE:
+            return pg_rrule_mod(((int64) year * 12 + month) - ((int64) compiled->dtstart.year * 12 + compiled->dtstart.month),
+                                compiled->interval) == 0;
+        case ICAL_YEARLY_RECURRENCE:
+            return pg_rrule_mod(year - compiled->dtstart.year, compiled->interval) == 0;
+        default:
+            return true;
+    }
+}
+
+/* INTERVAL for DAILY and WEEKLY rules */
+static bool pg_rrule_day_aligned(const pg_rrule_compiled *compiled, int64 day_number) {
+    switch (compiled->freq) {
+        case ICAL_DAILY_RECURRENCE:
+            return pg_rrule_mod(day_number - compiled->dtstart_days, compiled->interval) == 0;
+        case ICAL_WEEKLY_RECURRENCE:
+            return pg_rrule_mod(pg_rrule_week(day_number, compiled->week_start) -
+                                pg_rrule_week(compiled->dtstart_days, compiled->week_start),
+                                compiled->interval) == 0;
+        default:
+            return true;
+    }
+}
+
+/* Hours of a day, with INTERVAL for HOURLY rules */
+static uint32 pg_rrule_hours_of_day(const pg_rrule_compiled *compiled, int64 day_number) {
+    if (compiled->freq == ICAL_HOURLY_RECURRENCE && compiled->interval > 1) {
+        return compiled->hours & (uint32) pg_rrule_aligned_mask(pg_rrule_floor_div(compiled->dtstart_civil, SECS_PER_HOUR),
+                                                                day_number * HOURS_PER_DAY, HOURS_PER_DAY, compiled->interval);
+    }
+    return compiled->hours;
+}
+
+/* Minutes of an hour, with INTERVAL for MINUTELY rules */
+static uint64 pg_rrule_minutes_of_hour(const pg_rrule_compiled *compiled, int64 hour_number) {
+    if (compiled->freq == ICAL_MINUTELY_RECURRENCE && compiled->interval > 1) {
+        return compiled->minutes & pg_rrule_aligned_mask(pg_rrule_floor_div(compiled->dtstart_civil, SECS_PER_MINUTE),
+                                                         hour_number * MINS_PER_HOUR, MINS_PER_HOUR, compiled->interval);
+    }
+    return compiled->minutes;
+}
+
+/* Seconds of a minute, with INTERVAL for SECONDLY rules */
+static uint64 pg_rrule_seconds_of_minute(const pg_rrule_compiled *compiled, int64 minute_number) {
+    if (compiled->freq == ICAL_SECONDLY_RECURRENCE && compiled->interval > 1) {
+        return compiled->seconds & pg_rrule_aligned_mask(compiled->dtstart_civil, minute_number * SECS_PER_MINUTE,
+                                                         SECS_PER_MINUTE, compiled->interval);
+    }
+    return compiled->seconds;
+}
+
+/* Loads the next month holding candidate days into the engine */
+static bool pg_rrule_engine_load_month(pg_rrule_engine *engine) {
+    const pg_rrule_compiled *compiled = &engine->rule;
+    int year = engine->next_year;
+    int month = engine->next_month;
+
+    for (;;) {
+        // Rules matching rarely, if ever, may scan many months
+        CHECK_FOR_INTERRUPTS();
+
+        if (year > PG_RRULE_ENGINE_MAX_YEAR) {
+            return false;
+        }
+
+        const int64 first_day = pg_rrule_days_from_civil(year, month, 1);
+        if (engine->has_upper && first_day * SECS_PER_DAY > engine->upper) {
+            return false;
+        }
+
+        // Jump over whole periods skipped by INTERVAL
+        if (!pg_rrule_month_aligned(compiled, year, month)) {
+            if (compiled->freq == ICAL_YEARLY_RECURRENCE) {
+                year += compiled->interval - (int) pg_rrule_mod(year - compiled->dtstart.year, compiled->interval);
+                month = 1;
+            } else {
+                int64 index = (int64) year * 12 + month - 1;
+                index += compiled->interval -
+                         pg_rrule_mod(index - ((int64) compiled->dtstart.year * 12 + compiled->dtstart.month - 1), compiled->interval);
+                year = (int) (index / 12);
+                month = (int) (index % 12) + 1;
+            }
+            continue;
+        }
+
+        const uint32 days = ((compiled->months >> month) & 1) ? pg_rrule_day_mask(compiled, year, month, first_day) : 0;
+
+        engine->next_year = month == 12 ? year + 1 : year;
+        engine->next_month = month == 12 ? 1 : month + 1;
+
+        if (days != 0) {
+            engine->year = year;
+            engine->month = month;
+            engine->month_first_day = first_day;
+            engine->days_left = days;
+            return true;
+        }
+
+        year = engine->next_year;
+        month = engine->next_month;
+    }
+}
+
+/* Candidates below this can be skipped in bulk; COUNT-bounded rules must still number everything after DTSTART */
+static int64 pg_rrule_engine_skip_below(const pg_rrule_engine *engine) {
+    return engine->rule.count > 0 ? engine->rule.dtstart_civil : engine->lower;
+}
+
+bool pg_rrule_compile(const struct icalrecurrencetype *recurrence, struct icaltimetype dtstart, pg_rrule_compiled *compiled) {
+    const icalrecurrencetype_frequency freq = recurrence->freq;
+
+    if (freq < ICAL_SECONDLY_RECURRENCE || freq > ICAL_YEARLY_RECURRENCE) {
+        return false;
+    }
+
+    if (recurrence->rscale != NULL || dtstart.is_date ||
+        recurrence->by[ICAL_BY_SET_POS].size > 0 || recurrence->by[ICAL_BY_WEEK_NO].size > 0) {
+        return false;
+    }
+
+    // Combinations RFC 5545 doesn't define are left to libical's interpretation
+    if ((recurrence->by[ICAL_BY_YEAR_DAY].size > 0 &&
+         (freq == ICAL_DAILY_RECURRENCE || freq == ICAL_WEEKLY_RECURRENCE || freq == ICAL_MONTHLY_RECURRENCE)) ||
+        (recurrence->by[ICAL_BY_MONTH_DAY].size > 0 && freq == ICAL_WEEKLY_RECURRENCE)) {
+        return false;
+    }
+
+    const bool has_until =!icaltime_is_null_time(recurrence->until);
+    if (has_until && recurrence->until.is_date) {
+        return false;
+    }
+
+    memset(compiled, 0, sizeof(pg_rrule_compiled));
+    compiled->freq = freq;
+    compiled->interval = recurrence->interval > 0 ? recurrence->interval : 1;
+    compiled->count = recurrence->count > 0 ? recurrence->count : 0;
+    compiled->dtstart = dtstart;
+    compiled->dtstart_civil = pg_rrule_civil_seconds(dtstart);
+    compiled->dtstart_days = pg_rrule_days_from_civil(dtstart.year, dtstart.month, dtstart.day);
+    compiled->week_start = recurrence->week_start != ICAL_NO_WEEKDAY ? (int) recurrence->week_start : (int) ICAL_MONDAY_WEEKDAY;
+
+    if (has_until) {
+        // libical compares UNTIL in UTC, see pg_rrule_get_until()
+        const icaltime_t until_t = icaltime_as_timet_with_zone(recurrence->until, icaltimezone_get_utc_timezone());
+        compiled->has_until = true;
+        compiled->until = pg_rrule_civil_seconds(icaltime_from_timet_with_zone(until_t, 0, dtstart.zone));
+    }
+
+    const bool has_month = recurrence->by[ICAL_BY_MONTH].size > 0;
+    const bool has_yearday = recurrence->by[ICAL_BY_YEAR_DAY].size > 0;
+    const bool has_monthday = recurrence->by[ICAL_BY_MONTH_DAY].size > 0;
+    const bool has_day = recurrence->by[ICAL_BY_DAY].size > 0;
+    const bool yearly_defaults = freq == ICAL_YEARLY_RECURRENCE && !has_yearday && !has_monthday && !has_day;
+    uint64 mask;
+
+    // Time of day: missing parts default to DTSTART's, unless the frequency iterates over them
+    if (!pg_rrule_compile_part(recurrence, ICAL_BY_SECOND, 0, 59, &mask)) {
+        return false;
+    }
+    compiled->seconds = recurrence->by[ICAL_BY_SECOND].size > 0 ? mask :
+                        freq > ICAL_SECONDLY_RECURRENCE ? UINT64CONST(1) << dtstart.second : PG_RRULE_ALL_SECONDS;
+
+    if (!pg_rrule_compile_part(recurrence, ICAL_BY_MINUTE, 0, 59, &mask)) {
+        return false;
+    }
+    compiled->minutes = recurrence->by[ICAL_BY_MINUTE].size > 0 ? mask :
+                        freq > ICAL_MINUTELY_RECURRENCE ? UINT64CONST(1) << dtstart.minute : PG_RRULE_ALL_MINUTES;
+
+    if (!pg_rrule_compile_part(recurrence, ICAL_BY_HOUR, 0, 23, &mask)) {
+        return false;
+    }
+    compiled->hours = recurrence->by[ICAL_BY_HOUR].size > 0 ? (uint32) mask :
+                      freq > ICAL_HOURLY_RECURRENCE ? (uint32) 1 << dtstart.hour : PG_RRULE_ALL_HOURS;
+
+    // Date: same idea, following the defaults of RFC 5545 section 3.3.10
+    if (!pg_rrule_compile_part(recurrence, ICAL_BY_MONTH, 1, 12, &mask)) {
+        return false;
+    }
+    compiled->months = has_month ? (uint16) mask :
+                       yearly_defaults ? (uint16) (1 << dtstart.month) : PG_RRULE_ALL_MONTHS;
+
+    for (int i = 0; i < recurrence->by[ICAL_BY_DAY].size; i++) {
+        const short value = recurrence->by[ICAL_BY_DAY].data[i];
+        const int weekday = (int) icalrecurrencetype_day_day_of_week(value);
+        if (icalrecurrencetype_day_position(value) != 0 || weekday < 1 || weekday > 7) {
+            return false;
+        }
+        compiled->weekdays |= (uint8) (1 << (weekday - 1));
+    }
+    if (!has_day) {
+        compiled->weekdays = freq == ICAL_WEEKLY_RECURRENCE ? (uint8) (1 << (pg_rrule_weekday(compiled->dtstart_days) - 1))
+                                                            : PG_RRULE_ALL_WEEKDAYS;
+    }
+
+    for (int i = 0; i < recurrence->by[ICAL_BY_MONTH_DAY].size; i++) {
+        const int value = recurrence->by[ICAL_BY_MONTH_DAY].data[i];
+        if (value >= 1 && value <= 31) {
+            compiled->monthdays |= (uint32) 1 << value;
+        } else if (value <= -1 && value >= -31) {
+            compiled->monthdays_neg |= (uint32) 1 << -value;
+        } else {
+            return false;
+        }
+    }
+    if (has_monthday) {
+        compiled->has_monthdays = true;
+    } else if ((freq == ICAL_MONTHLY_RECURRENCE && !has_day && !has_yearday) || yearly_defaults) {
+        compiled->has_monthdays = true;
+        compiled->monthdays = (uint32) 1 << dtstart.day;
+    }
+
+    for (int i = 0; i < recurrence->by[ICAL_BY_YEAR_DAY].size; i++) {
+        const int value = recurrence->by[ICAL_BY_YEAR_DAY].data[i];
+        if (value >= 1 && value <= 366) {
+            pg_rrule_bit_set(compiled->yeardays, value);
+        } else if (value <= -1 && value >= -366) {
+            pg_rrule_bit_set(compiled->yeardays_neg, -value);
+        } else {
+            return false;
+        }
+    }
+    compiled->has_yeardays = has_yearday;
+
+    return true;
+}
+
+bool pg_rrule_compiled_matches(const pg_rrule_compiled *compiled, struct icaltimetype tt) {
+    const int64 civil = pg_rrule_civil_seconds(tt);
+
+    if (civil < compiled->dtstart_civil || (compiled->has_until && civil > compiled->until) || tt.second > 59) {
+        return false;
+    }
+
+    if (!((compiled->months >> tt.month) & 1) || !pg_rrule_month_aligned(compiled, tt.year, tt.month)) {
+        return false;
+    }
+
+    const int64 first_day = pg_rrule_days_from_civil(tt.year, tt.month, 1);
+    const int64 day_number = first_day + tt.day - 1;
+    if (!((pg_rrule_day_mask(compiled, tt.year, tt.month, first_day) >> tt.day) & 1) ||
+        !pg_rrule_day_aligned(compiled, day_number)) {
+        return false;
+    }
+
+    const int64 hour_number = day_number * HOURS_PER_DAY + tt.hour;
+    const int64 minute_number = hour_number * MINS_PER_HOUR + tt.minute;
+
+    return ((pg_rrule_hours_of_day(compiled, day_number) >> tt.hour) & 1) &&
+           ((pg_rrule_minutes_of_hour(compiled, hour_number) >> tt.minute) & 1) &&
+           ((pg_rrule_seconds_of_minute(compiled, minute_number) >> tt.second) & 1);
+}
+
+bool pg_rrule_compiled_period(const pg_rrule_compiled *compiled, int64 *period, int64 *phase, int64 *width) {
+    // Offsets inside a period are day * SECS_PER_DAY + hour * SECS_PER_HOUR + ...; parts the frequency doesn't expand are fixed at 0
+    uint64 days = 1, hours = 1, minutes = 1, seconds = 1;
+    int64 base, length;
+
+    switch (compiled->freq) {
+        case ICAL_SECONDLY_RECURRENCE:
+            base = compiled->dtstart_civil;
+            length = 1;
+            break;
+        case ICAL_MINUTELY_RECURRENCE:
+            base = compiled->dtstart_civil - compiled->dtstart.second;
+            length = SECS_PER_MINUTE;
+            seconds = compiled->seconds;
+            break;
+        case ICAL_HOURLY_RECURRENCE:
+            base = compiled->dtstart_civil - compiled->dtstart.minute * SECS_PER_MINUTE - compiled->dtstart.second;
+            length = SECS_PER_HOUR;
+            seconds = compiled->seconds;
+            minutes = compiled->minutes;
+            break;
+        case ICAL_DAILY_RECURRENCE:
+            base = compiled->dtstart_days * SECS_PER_DAY;
+            length = SECS_PER_DAY;
+            seconds = compiled->seconds;
+            minutes = compiled->minutes;
+            hours = compiled->hours;
+            break;
+        case ICAL_WEEKLY_RECURRENCE: {
+            const int64 first_day = pg_rrule_week(compiled->dtstart_days, compiled->week_start) * 7 + compiled->week_start - 5;
+            base = first_day * SECS_PER_DAY;
+            length = 7 * SECS_PER_DAY;
+            seconds = compiled->seconds;
+            minutes = compiled->minutes;
+            hours = compiled->hours;
+            days = 0;
+            for (int day = 0; day < 7; day++) {
+                if (compiled->weekdays & (1 << (pg_rrule_weekday(first_day + day) - 1))) {
+                    days |= UINT64CONST(1) << day;
+                }
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+
+    if (days == 0 || hours == 0 || minutes == 0 || seconds == 0 ||
+        pg_popcount64(days) * pg_popcount64(hours) * pg_popcount64(minutes) * pg_popcount64(seconds) > 10000) {
+        return false;
+    }
+
+    *period = length * compiled->interval;
+
+    // Offsets come out in increasing order; the arc is the circle minus the largest gap between neighbours
+    int64 first = -1, last = -1, gap = 0, arc_start = 0;
+    for (uint64 d = days; d != 0; d &= d - 1) {
+        for (uint64 h = hours; h != 0; h &= h - 1) {
+            for (uint64 m = minutes; m != 0; m &= m - 1) {
+                for (uint64 sec = seconds; sec != 0; sec &= sec - 1) {
+                    const int64 offset = pg_rightmost_one_pos64(d) * SECS_PER_DAY + pg_rightmost_one_pos64(h) * SECS_PER_HOUR +
+                                         pg_rightmost_one_pos64(m) * SECS_PER_MINUTE + pg_rightmost_one_pos64(sec);
+                    if (first < 0) {
+                        first = offset;
+                    } else if (offset - last > gap) {
+                        gap = offset - last;
+                        arc_start = offset;
+                    }
+                    last = offset;
+                }
+            }
+        }
+    }
+
+    if (first + *period - last >= gap) {
+        *phase = pg_rrule_mod(base + first, *period);
+        *width = last - first;
+    } else {
+        *phase = pg_rrule_mod(base + arc_start, *period);
+        *width = *period - gap;
+    }
+    return true;
+}
+
+void pg_rrule_engine_init(pg_rrule_engine *engine, const pg_rrule_compiled *compiled, bool has_upper, int64 upper) {
+    memset(engine, 0, sizeof(pg_rrule_engine));
+    engine->rule = *compiled;
+
+    engine->has_upper = has_upper || compiled->has_until;
+    if (has_upper && compiled->has_until) {
+        engine->upper = Min(upper, compiled->until);
+    } else {
+        engine->upper = has_upper ? upper : compiled->until;
+    }
+
+    engine->lower = compiled->dtstart_civil;
+    engine->next_year = compiled->dtstart.year;
+    engine->next_month = compiled->dtstart.month;
+}
+
+void pg_rrule_engine_seek(pg_rrule_engine *engine, int64 lower) {
+    if (lower <= engine->lower) {
+        return;
+    }
+
+    engine->lower = lower;
+
+    if (engine->rule.count == 0) {
+        int year, month, day;
+        pg_rrule_civil_from_days(pg_rrule_floor_div(lower, SECS_PER_DAY), &year, &month, &day);
+        engine->next_year = year;
+        engine->next_month = month;
+    }
+}
+
+bool pg_rrule_engine_next(pg_rrule_engine *engine, int64 *out) {
+    const pg_rrule_compiled *compiled = &engine->rule;
+    const int64 skip_below = pg_rrule_engine_skip_below(engine);
+
+    while (!engine->done) {
+        if (engine->seconds_left != 0) {
+            const int second = pg_rightmost_one_pos64(engine->seconds_left);
+            engine->seconds_left &= engine->seconds_left - 1;
+
+            const int64 civil = engine->day_number * SECS_PER_DAY + engine->hour * SECS_PER_HOUR +
+                                engine->minute * SECS_PER_MINUTE + second;
+            if (civil < compiled->dtstart_civil) {
+                continue;
+            }
+
+            // Candidates come out in increasing order, so the first one out of bounds ends the series
+            if ((engine->has_upper && civil > engine->upper) ||
+                (compiled->count > 0 && engine->number >= compiled->count)) {
+                engine->done = true;
+                break;
+            }
+
+            engine->number++;
+            if (civil < engine->lower) {
+                continue;
+            }
+
+            *out = civil;
+            return true;
+        }
+
+        if (engine->minutes_left != 0) {
+            engine->minute = pg_rightmost_one_pos64(engine->minutes_left);
+            engine->minutes_left &= engine->minutes_left - 1;
+
+            const int64 minute_number = (engine->day_number * HOURS_PER_DAY + engine->hour) * MINS_PER_HOUR + engine->minute;
+            if ((minute_number + 1) * SECS_PER_MINUTE <= skip_below) {
+                continue;
+            }
+            engine->seconds_left = pg_rrule_seconds_of_minute(compiled, minute_number);
+            continue;
+        }
+
+        if (engine->hours_left != 0) {
+            engine->hour = pg_rightmost_one_pos32(engine->hours_left);
+            engine->hours_left &= engine->hours_left - 1;
+
+            const int64 hour_number = engine->day_number * HOURS_PER_DAY + engine->hour;
+            if ((hour_number + 1) * SECS_PER_HOUR <= skip_below) {
+                continue;
+            }
+            engine->minutes_left = pg_rrule_minutes_of_hour(compiled, hour_number);
+            continue;
+        }
+
+        if (engine->days_left != 0) {
+            const int day = pg_rightmost_one_pos32(engine->days_left);
+            engine->days_left &= engine->days_left - 1;
+
+            engine->day_number = engine->month_first_day + day - 1;
+            if ((engine->day_number + 1) * SECS_PER_DAY <= skip_below || !pg_rrule_day_aligned(compiled, engine->day_number)) {
+                continue;
+            }
+            engine->hours_left = pg_rrule_hours_of_day(compiled, engine->day_number);
+            continue;
+        }
+
+        if (!pg_rrule_engine_load_month(engine)) {
+            engine->done = true;
+        }
+    }
+
+    return false;
+}
+
+void pg_rrule_epoch_cache_init(pg_rrule_epoch_cache *cache, icaltimezone *zone) {
+    cache->zone = zone;
+    cache->utc = zone == NULL || zone == icaltimezone_get_utc_timezone();
+    cache->lo = 0;
+    cache->hi = 0;
+    cache->offset = 0;
+}
+
+static int64 pg_rrule_epoch_of(const pg_rrule_epoch_cache *cache, int64 civil) {
+    struct icaltimetype tt = pg_rrule_civil_time(civil, icaltime_null_time());
+    tt.zone = cache->zone;
+    return (int64) icaltime_as_timet_with_zone(tt, cache->zone);
+}
+
+int64 pg_rrule_civil_to_epoch_slow(pg_rrule_epoch_cache *cache, int64 civil) {
+    const int64 day_start = pg_rrule_floor_div(civil, SECS_PER_DAY) * SECS_PER_DAY;
+    const int64 day_end = day_start + SECS_PER_DAY - 1;
+    const int64 start_offset = day_start - pg_rrule_epoch_of(cache, day_start);
+    const int64 end_offset = day_end - pg_rrule_epoch_of(cache, day_end);
+
+    if (start_offset != end_offset) {
+        // A transition happens during this day
+        return pg_rrule_epoch_of(cache, civil);
+    }
+
+    if (cache->hi == day_start && cache->offset == start_offset) {
+        cache->hi += SECS_PER_DAY;
+    } else {
+        cache->lo = day_start;
+        cache->hi = day_start + SECS_PER_DAY;
+        cache->offset = start_offset;
+    }
+
+    return civil - start_offset;
+}
+
+void pg_rrule_civil_to_epoch_batch(pg_rrule_epoch_cache *cache, const int64 *civil, int64 *epoch, int n) {
+    if (cache->utc) {
+        if (epoch != civil) {
+            memcpy(epoch, civil, n * sizeof(int64));
+        }
+        return;
+    }
+
+    int i = 0;
+    while (i < n) {
+        const int64 lo = cache->lo;
+        const int64 hi = cache->hi;
+        const int64 offset = cache->offset;
+
+        int end = i;
+        while (end < n && civil[end] >= lo && civil[end] < hi) {
+            end++;
+        }
+
+        for (int k = i; k < end; k++) {
+            epoch[k] = civil[k] - offset;
+        }
+
+        if (end < n) {
+            epoch[end] = pg_rrule_civil_to_epoch_slow(cache, civil[end]);
+            end++;
+        }
+
+        i = end;
+    }
+}
+
+int64 pg_rrule_days_from_civil(int year, int month, int day) {
+    // Howard Hinnant's days_from_civil, eras are 400-year cycles starting at March 1st
+    const int y = year - (month <= 2);
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return (int64) era * 146097 + doe - 719468;
+}
+
+int64 pg_rrule_civil_seconds(struct icaltimetype tt) {
+    return pg_rrule_days_from_civil(tt.year, tt.month, tt.day) * SECS_PER_DAY
+           + tt.hour * SECS_PER_HOUR
+           + tt.minute * SECS_PER_MINUTE
+           + tt.second;
+}
+
+struct icaltimetype pg_rrule_civil_time(int64 civil, struct icaltimetype like) {
+    const int64 days = pg_rrule_floor_div(civil, SECS_PER_DAY);
+    const int seconds = (int) (civil - days * SECS_PER_DAY);
+
+    pg_rrule_civil_from_days(days, &like.year, &like.month, &like.day);
+    like.hour = seconds / SECS_PER_HOUR;
+    like.minute = seconds % SECS_PER_HOUR / SECS_PER_MINUTE;
+    like.second = seconds % SECS_PER_MINUTE;
+
+    return like;
+}
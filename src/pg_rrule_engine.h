@@ -0,0 +1,285 @@
+#ifndef PG_RRULE_ENGINE_H
+#define PG_RRULE_ENGINE_H
+
+#include <libical/ical.h>
+
+#include <postgres.h>
+
+/* ========================================================================
+ * Native Expansion Engine
+ *
+ * Enumerates the occurrences of the rule shapes we actually store without
+ * going through libical's generic iterator. The BY* arrays are compiled into
+ * bitsets once, then candidates are produced month by month: the days of a
+ * month, the hours of a day, the minutes of an hour and the seconds of a
+ * minute are each a single word, filtered with AND masks and walked with
+ * count-trailing-zeros.
+ *
+ * Everything is computed in the civil (wall clock) time of DTSTART's zone,
+ * like libical does; callers convert to epoch seconds.
+ * ======================================================================== */
+
+/**
+ * Last year the engine enumerates, mirroring libical's own cut-off for
+ * rules without COUNT or UNTIL.
+ */
+#define PG_RRULE_ENGINE_MAX_YEAR 2582
+
+/**
+ * pg_rrule_compiled - A rule compiled into bitsets
+ *
+ * BY* parts that are missing are filled in with the DTSTART defaults of
+ * RFC 5545, so a candidate is an occurrence exactly when every mask accepts
+ * it and it lies in a period selected by INTERVAL.
+ */
+typedef struct pg_rrule_compiled {
+    icalrecurrencetype_frequency freq;
+    int interval;
+    int count;                  /* 0 for no COUNT */
+    bool has_until;
+    int64 until;                /* civil seconds, DTSTART's zone */
+
+    struct icaltimetype dtstart;
+    int64 dtstart_civil;        /* civil seconds */
+    int64 dtstart_days;         /* days since 1970-01-01 */
+    int week_start;             /* ICAL_SUNDAY_WEEKDAY (1) ... ICAL_SATURDAY_WEEKDAY (7) */
+
+    uint64 seconds;             /* bit n: second n (0-59) */
+    uint64 minutes;             /* bit n: minute n (0-59) */
+    uint32 hours;               /* bit n: hour n (0-23) */
+    uint8 weekdays;             /* bit n: weekday n + 1 */
+    uint16 months;              /* bit n: month n (1-12) */
+    bool has_monthdays;
+    uint32 monthdays;           /* bit n: day n of the month */
+    uint32 monthdays_neg;       /* bit n: day -n of the month */
+    bool has_yeardays;
+    uint64 yeardays[6];         /* bit n: day n of the year (1-366) */
+    uint64 yeardays_neg[6];     /* bit n: day -n of the year */
+} pg_rrule_compiled;
+
+/**
+ * pg_rrule_compiled_period - Where occurrences fall inside their period
+ *
+ * For SECONDLY to WEEKLY rules every occurrence lies in a period of fixed
+ * length (INTERVAL seconds, minutes, hours, days or weeks) aligned on
+ * DTSTART, at an offset taken from the expanding BY* parts. This returns
+ * the shortest arc of the circle of length `period` holding all those
+ * offsets, so that every occurrence t satisfies
+ * (t - phase) mod period <= width.
+ *
+ * @param compiled Compiled rule
+ * @param period Output parameter for the period, in seconds
+ * @param phase Output parameter for the start of the arc, civil seconds in [0, period)
+ * @param width Output parameter for the length of the arc, in seconds
+ * @return false for MONTHLY and YEARLY rules, whose periods vary in length,
+ *         and when the BY* parts expand to too many offsets to walk cheaply
+ */
+bool pg_rrule_compiled_period(const pg_rrule_compiled *compiled, int64 *period, int64 *phase, int64 *width);
+
+/**
+ * pg_rrule_engine - Enumeration state of the native engine
+ */
+typedef struct pg_rrule_engine {
+    pg_rrule_compiled rule;
+
+    bool has_upper;
+    int64 upper;                /* civil seconds, inclusive */
+    int64 lower;                /* civil seconds, inclusive */
+    int64 number;               /* occurrences seen so far, for COUNT */
+    bool done;
+
+    int next_year;              /* next month to load */
+    int next_month;
+    int year;                   /* month being enumerated */
+    int month;
+    int64 month_first_day;
+    uint32 days_left;
+    int64 day_number;
+    uint32 hours_left;
+    int hour;
+    uint64 minutes_left;
+    int minute;
+    uint64 seconds_left;
+} pg_rrule_engine;
+
+/**
+ * pg_rrule_compile - Compile a rule for the native engine
+ *
+ * Supports SECONDLY to YEARLY rules with BYSECOND (0-59), BYMINUTE, BYHOUR,
+ * BYDAY without ordinal, BYMONTHDAY, BYYEARDAY and BYMONTH, plus INTERVAL,
+ * COUNT and a date-time UNTIL.
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @param dtstart Starting date/time for the recurrence
+ * @param compiled Output parameter for the compiled rule
+ * @return false for RSCALE, BYSETPOS, BYWEEKNO, ordinal BYDAY (e.g. 1MO),
+ *         leap seconds or date-only UNTIL; those must go through libical
+ */
+bool pg_rrule_compile(const struct icalrecurrencetype *recurrence,
+                      struct icaltimetype dtstart,
+                      pg_rrule_compiled *compiled);
+
+/**
+ * pg_rrule_compiled_matches - Check a single candidate against a compiled rule
+ *
+ * COUNT is not taken into account, as that depends on every earlier
+ * occurrence.
+ *
+ * @param compiled Compiled rule
+ * @param tt Candidate, as wall clock time in DTSTART's zone
+ * @return true if tt is an occurrence (ignoring COUNT)
+ */
+bool pg_rrule_compiled_matches(const pg_rrule_compiled *compiled, struct icaltimetype tt);
+
+/**
+ * pg_rrule_engine_init - Prepare an enumeration from DTSTART
+ *
+ * @param engine Engine state to initialize
+ * @param compiled Compiled rule (copied into engine)
+ * @param has_upper Whether `upper` bounds the enumeration
+ * @param upper Last civil second (inclusive) to enumerate
+ */
+void pg_rrule_engine_init(pg_rrule_engine *engine,
+                          const pg_rrule_compiled *compiled,
+                          bool has_upper,
+                          int64 upper);
+
+/**
+ * pg_rrule_engine_seek - Only produce occurrences at or after `lower`
+ *
+ * Without COUNT, enumeration jumps straight to the month of `lower`.
+ * With COUNT, earlier occurrences are still enumerated (and counted) but
+ * not returned. Must be called before the first pg_rrule_engine_next().
+ *
+ * @param engine Engine state
+ * @param lower Civil second (inclusive)
+ */
+void pg_rrule_engine_seek(pg_rrule_engine *engine, int64 lower);
+
+/**
+ * pg_rrule_engine_next - Produce the next occurrence
+ *
+ * @param engine Engine state
+ * @param out Output parameter for the occurrence, as civil seconds in DTSTART's zone
+ * @return false once the series or the bounds are exhausted
+ */
+bool pg_rrule_engine_next(pg_rrule_engine *engine, int64 *out);
+
+/* ========================================================================
+ * Epoch Conversion
+ *
+ * Occurrences come out as civil seconds of DTSTART's zone. Converting each
+ * one with icaltime_as_timet_with_zone() means a full calendar computation
+ * plus a search of the zone's transitions; instead the UTC offset of a run
+ * of whole days without transition is cached, so that inside the run the
+ * conversion is a single subtraction.
+ * ======================================================================== */
+
+/**
+ * pg_rrule_epoch_cache - UTC offset valid for the civil interval [lo, hi)
+ */
+typedef struct pg_rrule_epoch_cache {
+    icaltimezone *zone;
+    bool utc;                   /* no conversion needed at all */
+    int64 lo;                   /* civil seconds, inclusive */
+    int64 hi;                   /* civil seconds, exclusive */
+    int64 offset;               /* civil minus epoch seconds inside [lo, hi) */
+} pg_rrule_epoch_cache;
+
+/**
+ * pg_rrule_epoch_cache_init - Prepare conversions for a zone
+ *
+ * @param cache Cache to initialize
+ * @param zone Zone of the civil times, NULL or UTC for none
+ */
+void pg_rrule_epoch_cache_init(pg_rrule_epoch_cache *cache, icaltimezone *zone);
+
+/**
+ * pg_rrule_civil_to_epoch_slow - Convert outside the cached interval
+ *
+ * Checks the offset at both ends of the day holding `civil` and caches it
+ * when they agree. Days with a transition are converted by libical, so
+ * nonexistent and repeated wall clock times resolve exactly as before.
+ *
+ * @param cache Conversion cache
+ * @param civil Civil seconds
+ * @return Seconds since the epoch
+ */
+int64 pg_rrule_civil_to_epoch_slow(pg_rrule_epoch_cache *cache, int64 civil);
+
+/**
+ * pg_rrule_civil_to_epoch - Convert civil seconds of the cache's zone to epoch seconds
+ *
+ * @param cache Conversion cache
+ * @param civil Civil seconds
+ * @return Seconds since the epoch
+ */
+static inline int64 pg_rrule_civil_to_epoch(pg_rrule_epoch_cache *cache, int64 civil) {
+    if (cache->utc) {
+        return civil;
+    }
+    if (civil >= cache->lo && civil < cache->hi) {
+        return civil - cache->offset;
+    }
+    return pg_rrule_civil_to_epoch_slow(cache, civil);
+}
+
+/**
+ * pg_rrule_civil_to_epoch_batch - Convert an ascending run of civil times
+ *
+ * The prefix of the batch inside the cached interval is converted by a
+ * plain subtraction loop the compiler can vectorize; only the first element
+ * past it takes the slow path, after which the next prefix follows.
+ *
+ * @param cache Conversion cache
+ * @param civil Civil seconds, in ascending order
+ * @param epoch Output array for the epoch seconds (may alias civil)
+ * @param n Number of elements
+ */
+void pg_rrule_civil_to_epoch_batch(pg_rrule_epoch_cache *cache, const int64 *civil, int64 *epoch, int n);
+
+/**
+ * pg_rrule_days_from_civil - Days between 1970-01-01 and a proleptic Gregorian date
+ *
+ * @param year Year
+ * @param month Month (1-12)
+ * @param day Day of month (1-31)
+ * @return Number of days since 1970-01-01 (negative before it)
+ */
+int64 pg_rrule_days_from_civil(int year, int month, int day);
+
+/**
+ * pg_rrule_civil_seconds - Wall clock time of an icaltimetype as a plain second count
+ *
+ * Ignores the zone of `tt`: two times compare the same way as their wall
+ * clocks do, which is what the arithmetic on a rule's own zone needs.
+ *
+ * @param tt Date/time
+ * @return Seconds since 1970-01-01T00:00:00 in tt's own wall clock
+ */
+int64 pg_rrule_civil_seconds(struct icaltimetype tt);
+
+/**
+ * pg_rrule_civil_time - Inverse of pg_rrule_civil_seconds()
+ *
+ * @param civil Seconds since 1970-01-01T00:00:00 in some wall clock
+ * @param like Date/time whose zone and flags are kept
+ * @return `like` with its date and time of day replaced
+ */
+struct icaltimetype pg_rrule_civil_time(int64 civil, struct icaltimetype like);
+
+/**
+ * pg_rrule_floor_div - Division rounding towards negative infinity
+ *
+ * Period numbers of dates before 1970 are negative; C division would round
+ * them towards zero.
+ *
+ * @param a Dividend
+ * @param b Divisor (positive)
+ * @return floor(a / b)
+ */
+static inline int64 pg_rrule_floor_div(int64 a, int64 b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+#endif // PG_RRULE_ENGINE_H
@@ -0,0 +1,44 @@
+#ifndef PG_RRULE_LIMITS_H
+#define PG_RRULE_LIMITS_H
+
+#include <postgres.h>
+
+/* ========================================================================
+ * Expansion Limits
+ *
+ * A rule such as FREQ=SECONDLY without UNTIL or COUNT never ends. Every
+ * iterator stops at pg_rrule.max_occurrences and every occurrence array at
+ * pg_rrule.max_expansion_memory, raising an error or returning what was
+ * produced so far according to pg_rrule.limit_action. Spans, index keys and
+ * the && recheck are exempt, see pg_rrule_iterator. The settings are
+ * defined in _PG_init().
+ * ======================================================================== */
+
+/**
+ * pg_rrule_limit_action - Values of the pg_rrule.limit_action setting
+ */
+typedef enum pg_rrule_limit_action {
+    PG_RRULE_LIMIT_ERROR,       /* raise an error */
+    PG_RRULE_LIMIT_TRUNCATE     /* return the occurrences produced so far */
+} pg_rrule_limit_action;
+
+/**
+ * pg_rrule_max_occurrences - Value of the pg_rrule.max_occurrences setting
+ *
+ * Most occurrences a single iterator may produce, 0 for no limit.
+ */
+extern int pg_rrule_max_occurrences;
+
+/**
+ * pg_rrule_max_expansion_memory - Value of pg_rrule.max_expansion_memory, in kB
+ *
+ * Largest occurrence array a call may build, 0 for the allocation limit.
+ */
+extern int pg_rrule_max_expansion_memory;
+
+/**
+ * pg_rrule_limit_action_setting - Value of the pg_rrule.limit_action setting
+ */
+extern int pg_rrule_limit_action_setting;
+
+#endif // PG_RRULE_LIMITS_H
@@ -0,0 +1,91 @@
+#include "pg_rrule_series.h"
+
+/* Helpers */
+static int64 pg_rrule_series_mod(int64 a, int64 b) {
+    const int64 r = a % b;
+    return r < 0 ? r + b : r;
+}
+
+static double pg_rrule_series_key_length(const pg_rrule_series_key *key) {
+    return key->empty ? 0.0 : ((double) key->upper - (double) key->lower) / USECS_PER_SEC;
+}
+
+void pg_rrule_series_key_set_period(pg_rrule_series_key *key, int64 period, int64 phase, int64 width, int64 duration) {
+    const int64 period_usecs = period * USECS_PER_SEC;
+    const int64 width_usecs = width * USECS_PER_SEC + duration;
+
+    // An arc covering the whole circle says nothing
+    if (width_usecs >= period_usecs) {
+        key->period = 0;
+        return;
+    }
+
+    const int64 epoch_shift = (int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+    key->period = period_usecs;
+    key->phase = pg_rrule_series_mod((phase - epoch_shift) * USECS_PER_SEC, period_usecs);
+    key->width = width_usecs;
+}
+
+void pg_rrule_series_key_union(pg_rrule_series_key *key, const pg_rrule_series_key *other) {
+    if (other->empty) {
+        return;
+    }
+
+    if (key->empty) {
+        *key = *other;
+        return;
+    }
+
+    key->lower = Min(key->lower, other->lower);
+    key->upper = Max(key->upper, other->upper);
+
+    if (key->period == 0 || key->period != other->period) {
+        key->period = 0;
+        return;
+    }
+
+    // Shortest arc starting at either phase and reaching the end of both arcs
+    const int64 period = key->period;
+    const int64 from_key = Max(key->width, pg_rrule_series_mod(other->phase - key->phase, period) + other->width);
+    const int64 from_other = Max(other->width, pg_rrule_series_mod(key->phase - other->phase, period) + key->width);
+
+    if (Min(from_key, from_other) >= period) {
+        key->period = 0;
+    } else if (from_other < from_key) {
+        key->phase = other->phase;
+        key->width = from_other;
+    } else {
+        key->width = from_key;
+    }
+}
+
+bool pg_rrule_series_key_overlaps(const pg_rrule_series_key *key, TimestampTz lower, TimestampTz upper) {
+    if (key->empty || upper < key->lower || lower > key->upper) {
+        return false;
+    }
+
+    if (key->period == 0) {
+        return true;
+    }
+
+    lower = Max(lower, key->lower);
+    upper = Min(upper, key->upper);
+    if (upper == DT_NOEND || upper - lower >= key->period - key->width) {
+        return true;
+    }
+
+    // Position of `lower` on the circle; either it is on the arc or the arc starts again before `upper`
+    const int64 position = pg_rrule_series_mod(lower - key->phase, key->period);
+    return position <= key->width || upper - lower >= key->period - position;
+}
+
+float pg_rrule_series_key_penalty(const pg_rrule_series_key *key, const pg_rrule_series_key *other) {
+    pg_rrule_series_key merged = *key;
+    pg_rrule_series_key_union(&merged, other);
+
+    double penalty = pg_rrule_series_key_length(&merged) - pg_rrule_series_key_length(key);
+    if (key->period != 0 && merged.period == 0) {
+        penalty += 1.0;
+    }
+    return (float) penalty;
+}
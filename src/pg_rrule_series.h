@@ -0,0 +1,94 @@
+#ifndef PG_RRULE_SERIES_H
+#define PG_RRULE_SERIES_H
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <datatype/timestamp.h>
+
+/* ========================================================================
+ * Series
+ *
+ * An rrule_series is a rule together with its DTSTART and the duration of
+ * each occurrence, so that "series with an occurrence in a window" can be
+ * answered and indexed without the caller passing DTSTART around. Series
+ * are always expanded in UTC, which keeps everything derived from them,
+ * index keys included, independent of the session's TimeZone.
+ * ======================================================================== */
+
+/**
+ * pg_rrule_series - On-disk form of rrule_series
+ *
+ * `rule` holds the payload of an rrule value in the format of
+ * pg_rrule_storage.h.
+ */
+typedef struct pg_rrule_series {
+    int32 vl_len_;
+    TimestampTz dtstart;
+    int64 duration;             /* microseconds, not negative */
+    char rule[FLEXIBLE_ARRAY_MEMBER];
+} pg_rrule_series;
+
+#define PG_RRULE_SERIES_HDRSZ offsetof(pg_rrule_series, rule)
+#define PG_RRULE_SERIES_RULE_LEN(series) (VARSIZE(series) - PG_RRULE_SERIES_HDRSZ)
+
+/* The fields are 8-byte aligned, so short varlena headers are expanded */
+#define PG_GETARG_RRULE_SERIES_P(n) ((pg_rrule_series *) PG_DETOAST_DATUM(PG_GETARG_DATUM(n)))
+
+/**
+ * pg_rrule_series_key - GiST key summarizing one or more series
+ *
+ * Every occurrence, duration included, of every series below the key lies
+ * within [lower, upper], and when `period` is not 0 also on the arc of
+ * `width` microseconds starting at `phase` modulo `period`. Leaf keys get a
+ * period from pg_rrule_compiled_period(); inner keys keep it as long as all
+ * their children share it.
+ */
+typedef struct pg_rrule_series_key {
+    TimestampTz lower;
+    TimestampTz upper;          /* DT_NOEND for series that never end */
+    int64 period;               /* microseconds, 0 if unknown */
+    int64 phase;                /* microseconds in [0, period) */
+    int64 width;                /* microseconds, less than period */
+    int32 empty;                /* no occurrences at all */
+    int32 padding;
+} pg_rrule_series_key;
+
+/**
+ * pg_rrule_series_key_set_period - Add the periodic part to a leaf key
+ *
+ * @param key Key whose extent is already set
+ * @param period Period in seconds, as from pg_rrule_compiled_period()
+ * @param phase Start of the arc, civil seconds of UTC
+ * @param width Length of the arc in seconds
+ * @param duration Duration of each occurrence in microseconds
+ */
+void pg_rrule_series_key_set_period(pg_rrule_series_key *key, int64 period, int64 phase, int64 width, int64 duration);
+
+/**
+ * pg_rrule_series_key_union - Widen a key so that it also covers another one
+ *
+ * @param key Key to widen
+ * @param other Key to cover
+ */
+void pg_rrule_series_key_union(pg_rrule_series_key *key, const pg_rrule_series_key *other);
+
+/**
+ * pg_rrule_series_key_overlaps - Whether a key may hold an occurrence inside [lower, upper]
+ *
+ * @param key Key to test
+ * @param lower Start of the window, inclusive (DT_NOBEGIN for none)
+ * @param upper End of the window, inclusive (DT_NOEND for none)
+ * @return false only if no series below the key can match
+ */
+bool pg_rrule_series_key_overlaps(const pg_rrule_series_key *key, TimestampTz lower, TimestampTz upper);
+
+/**
+ * pg_rrule_series_key_penalty - Cost of adding a key to a subtree
+ *
+ * @param key Key of the subtree
+ * @param other Key to add
+ * @return Growth of the extent in seconds, plus one if the period is lost
+ */
+float pg_rrule_series_key_penalty(const pg_rrule_series_key *key, const pg_rrule_series_key *other);
+
+#endif // PG_RRULE_SERIES_H
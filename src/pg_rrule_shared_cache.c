@@ -0,0 +1,283 @@
+#include "pg_rrule_shared_cache.h"
+
+int pg_rrule_shared_cache_size = 0;
+int pg_rrule_shared_cache_max_entries = 4096;
+
+uint64 pg_rrule_shared_cache_hits = 0;
+
+#if PG_VERSION_NUM >= 150000
+
+#include <common/hashfn.h>
+#include <lib/dshash.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/dsa.h>
+#include <utils/memutils.h>
+
+/* Attempts at evicting before giving up on caching a result */
+#define PG_RRULE_SHARED_CACHE_MAX_EVICTIONS 8
+
+/* Padding-free, so that the default memcmp/memhash functions can be used */
+typedef struct pg_rrule_shared_key {
+    uint64 hash;
+    uint64 len;
+} pg_rrule_shared_key;
+
+typedef struct pg_rrule_shared_entry {
+    pg_rrule_shared_key key;
+    dsa_pointer data;                   /* key bytes, then result bytes */
+    Size size;
+    pg_atomic_uint64 last_used;         /* value of the clock at the last hit */
+} pg_rrule_shared_entry;
+
+typedef struct pg_rrule_shared_state {
+    LWLock *lock;                       /* protects creating the area */
+    int tranche_id;
+    dsa_handle area;
+    dshash_table_handle table;
+    pg_atomic_uint64 clock;
+    pg_atomic_uint64 bytes;             /* bytes of all entries' data */
+    pg_atomic_uint32 nentries;
+} pg_rrule_shared_state;
+
+static pg_rrule_shared_state *pg_rrule_shared = NULL;
+static dsa_area *pg_rrule_shared_area = NULL;
+static dshash_table *pg_rrule_shared_table = NULL;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static const dshash_parameters pg_rrule_shared_params = {
+    .key_size = sizeof(pg_rrule_shared_key),
+    .entry_size = sizeof(pg_rrule_shared_entry),
+    .compare_function = dshash_memcmp,
+    .hash_function = dshash_memhash,
+#if PG_VERSION_NUM >= 170000
+    .copy_function = dshash_memcpy,
+#endif
+    .tranche_id = 0,                    /* set on attach */
+};
+
+/* Hooks */
+static void pg_rrule_shared_cache_request(void) {
+    if (prev_shmem_request_hook) {
+        prev_shmem_request_hook();
+    }
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(pg_rrule_shared_state)));
+    RequestNamedLWLockTranche("pg_rrule", 1);
+}
+
+static void pg_rrule_shared_cache_startup(void) {
+    if (prev_shmem_startup_hook) {
+        prev_shmem_startup_hook();
+    }
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    bool found;
+    pg_rrule_shared = ShmemInitStruct("pg_rrule", sizeof(pg_rrule_shared_state), &found);
+    if (!found) {
+        pg_rrule_shared->lock = &(GetNamedLWLockTranche("pg_rrule"))->lock;
+        pg_rrule_shared->tranche_id = LWLockNewTrancheId();
+        pg_rrule_shared->area = DSA_HANDLE_INVALID;
+        pg_rrule_shared->table = DSHASH_HANDLE_INVALID;
+        pg_atomic_init_u64(&pg_rrule_shared->clock, 0);
+        pg_atomic_init_u64(&pg_rrule_shared->bytes, 0);
+        pg_atomic_init_u32(&pg_rrule_shared->nentries, 0);
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+void pg_rrule_shared_cache_install(void) {
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = pg_rrule_shared_cache_request;
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = pg_rrule_shared_cache_startup;
+}
+
+/* Helpers */
+static bool pg_rrule_shared_cache_attach(void) {
+    if (pg_rrule_shared_table != NULL) {
+        return true;
+    }
+
+    dshash_parameters params = pg_rrule_shared_params;
+    params.tranche_id = pg_rrule_shared->tranche_id;
+    LWLockRegisterTranche(pg_rrule_shared->tranche_id, "pg_rrule_shared_cache");
+
+    // Mappings live as long as the backend, the area as long as the server
+    MemoryContext old_context = MemoryContextSwitchTo(TopMemoryContext);
+    LWLockAcquire(pg_rrule_shared->lock, LW_EXCLUSIVE);
+
+    if (pg_rrule_shared->area == DSA_HANDLE_INVALID) {
+        pg_rrule_shared_area = dsa_create(pg_rrule_shared->tranche_id);
+        dsa_pin(pg_rrule_shared_area);
+        dsa_pin_mapping(pg_rrule_shared_area);
+        pg_rrule_shared_table = dshash_create(pg_rrule_shared_area, &params, NULL);
+
+        pg_rrule_shared->area = dsa_get_handle(pg_rrule_shared_area);
+        pg_rrule_shared->table = dshash_get_hash_table_handle(pg_rrule_shared_table);
+    } else {
+        pg_rrule_shared_area = dsa_attach(pg_rrule_shared->area);
+        dsa_pin_mapping(pg_rrule_shared_area);
+        pg_rrule_shared_table = dshash_attach(pg_rrule_shared_area, &params, pg_rrule_shared->table, NULL);
+    }
+
+    LWLockRelease(pg_rrule_shared->lock);
+    MemoryContextSwitchTo(old_context);
+
+    return true;
+}
+
+static pg_rrule_shared_key pg_rrule_shared_cache_key(const char *key, Size key_len) {
+    pg_rrule_shared_key shared_key;
+    shared_key.hash = DatumGetUInt64(hash_any_extended((const unsigned char *) key, (int) key_len, 0));
+    shared_key.len = key_len;
+    return shared_key;
+}
+
+static void pg_rrule_shared_cache_free(pg_rrule_shared_entry *entry) {
+    dsa_free(pg_rrule_shared_area, entry->data);
+    pg_atomic_sub_fetch_u64(&pg_rrule_shared->bytes, entry->size);
+}
+
+static bool pg_rrule_shared_cache_evict(void) {
+    pg_rrule_shared_key oldest_key;
+    uint64 oldest = PG_UINT64_MAX;
+
+    // Full scan, but only when the cache is full, and the table is bounded
+    dshash_seq_status status;
+    dshash_seq_init(&status, pg_rrule_shared_table, false);
+    pg_rrule_shared_entry *entry;
+    while ((entry = dshash_seq_next(&status)) != NULL) {
+        const uint64 last_used = pg_atomic_read_u64(&entry->last_used);
+        if (last_used < oldest) {
+            oldest = last_used;
+            oldest_key = entry->key;
+        }
+    }
+    dshash_seq_term(&status);
+
+    if (oldest == PG_UINT64_MAX) {
+        return false;
+    }
+
+    // Another backend may have got there first; that frees room just as well
+    entry = dshash_find(pg_rrule_shared_table, &oldest_key, true);
+    if (entry != NULL) {
+        pg_rrule_shared_cache_free(entry);
+        pg_atomic_sub_fetch_u32(&pg_rrule_shared->nentries, 1);
+        dshash_delete_entry(pg_rrule_shared_table, entry);
+    }
+    return true;
+}
+
+bool pg_rrule_shared_cache_enabled(void) {
+    return pg_rrule_shared != NULL && pg_rrule_shared_cache_size > 0;
+}
+
+bool pg_rrule_shared_cache_lookup(const char *key, Size key_len, char **result, Size *result_len) {
+    if (!pg_rrule_shared_cache_enabled() || !pg_rrule_shared_cache_attach()) {
+        return false;
+    }
+
+    const pg_rrule_shared_key shared_key = pg_rrule_shared_cache_key(key, key_len);
+    pg_rrule_shared_entry *entry = dshash_find(pg_rrule_shared_table, &shared_key, false);
+    if (entry == NULL) {
+        return false;
+    }
+
+    // Equal hashes and lengths are not enough
+    const char *data = dsa_get_address(pg_rrule_shared_area, entry->data);
+    if (memcmp(data, key, key_len) != 0) {
+        dshash_release_lock(pg_rrule_shared_table, entry);
+        return false;
+    }
+
+    *result_len = entry->size - key_len;
+    *result = palloc(*result_len);
+    memcpy(*result, data + key_len, *result_len);
+    pg_atomic_write_u64(&entry->last_used, pg_atomic_fetch_add_u64(&pg_rrule_shared->clock, 1));
+
+    dshash_release_lock(pg_rrule_shared_table, entry);
+
+    pg_rrule_shared_cache_hits++;
+    return true;
+}
+
+void pg_rrule_shared_cache_store(const char *key, Size key_len, const char *result, Size result_len) {
+    if (!pg_rrule_shared_cache_enabled() || !pg_rrule_shared_cache_attach()) {
+        return;
+    }
+
+    const Size budget = (Size) pg_rrule_shared_cache_size * 1024 * 1024;
+    const Size size = key_len + result_len;
+    if (size > budget) {
+        return;
+    }
+
+    for (int i = 0; i < PG_RRULE_SHARED_CACHE_MAX_EVICTIONS; i++) {
+        if (pg_atomic_read_u32(&pg_rrule_shared->nentries) < (uint32) pg_rrule_shared_cache_max_entries &&
+            pg_atomic_read_u64(&pg_rrule_shared->bytes) + size <= budget) {
+            break;
+        }
+        if (!pg_rrule_shared_cache_evict()) {
+            break;
+        }
+    }
+    if (pg_atomic_read_u32(&pg_rrule_shared->nentries) >= (uint32) pg_rrule_shared_cache_max_entries ||
+        pg_atomic_read_u64(&pg_rrule_shared->bytes) + size > budget) {
+        return;
+    }
+
+    const dsa_pointer data = dsa_allocate_extended(pg_rrule_shared_area, size, DSA_ALLOC_NO_OOM);
+    if (!DsaPointerIsValid(data)) {
+        return;
+    }
+    char *address = dsa_get_address(pg_rrule_shared_area, data);
+    memcpy(address, key, key_len);
+    memcpy(address + key_len, result, result_len);
+    pg_atomic_add_fetch_u64(&pg_rrule_shared->bytes, size);
+
+    const pg_rrule_shared_key shared_key = pg_rrule_shared_cache_key(key, key_len);
+    bool found;
+    pg_rrule_shared_entry *entry = dshash_find_or_insert(pg_rrule_shared_table, &shared_key, &found);
+    if (found) {
+        // Stored meanwhile by another backend, or a hash collision; keep the newest
+        pg_rrule_shared_cache_free(entry);
+    } else {
+        pg_atomic_add_fetch_u32(&pg_rrule_shared->nentries, 1);
+        pg_atomic_init_u64(&entry->last_used, 0);
+    }
+    entry->data = data;
+    entry->size = size;
+    pg_atomic_write_u64(&entry->last_used, pg_atomic_fetch_add_u64(&pg_rrule_shared->clock, 1));
+
+    dshash_release_lock(pg_rrule_shared_table, entry);
+}
+
+#else
+
+void pg_rrule_shared_cache_install(void) {
+    ereport(WARNING,
+            (errmsg("pg_rrule shared cache requires PostgreSQL 15 or later"),
+             errhint("pg_rrule.shared_cache_size is ignored.")));
+}
+
+bool pg_rrule_shared_cache_enabled(void) {
+    return false;
+}
+
+bool pg_rrule_shared_cache_lookup(const char *key, Size key_len, char **result, Size *result_len) {
+    return false;
+}
+
+void pg_rrule_shared_cache_store(const char *key, Size key_len, const char *result, Size result_len) {
+}
+
+#endif
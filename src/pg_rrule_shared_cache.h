@@ -0,0 +1,75 @@
+#ifndef PG_RRULE_SHARED_CACHE_H
+#define PG_RRULE_SHARED_CACHE_H
+
+#include <postgres.h>
+
+/* ========================================================================
+ * Shared Expansion Cache
+ *
+ * Second level behind the per-call-site cache of pg_rrule_cache.h, shared
+ * by every backend: a dshash table in a DSA area, keyed like the first
+ * level. Keys start with the database and function OIDs, so that the
+ * arguments of different functions never meet. Rules expanded by all
+ * connections (holidays, shift rotations, billing cycles) are then
+ * expanded once per server instead of once per connection. It needs pg_rrule in shared_preload_libraries and a non-zero
+ * pg_rrule.shared_cache_size; otherwise every call here is a no-op.
+ * Requires PostgreSQL 15 or later.
+ * ======================================================================== */
+
+/**
+ * pg_rrule_shared_cache_size - Value of pg_rrule.shared_cache_size, in MB
+ *
+ * Memory for cached results (bookkeeping excluded); 0 disables the cache.
+ */
+extern int pg_rrule_shared_cache_size;
+
+/**
+ * pg_rrule_shared_cache_max_entries - Value of pg_rrule.shared_cache_max_entries
+ *
+ * Most results kept at once, whatever their size.
+ */
+extern int pg_rrule_shared_cache_max_entries;
+
+/* Backend-local counter, reported by rrule_cache_stats() */
+extern uint64 pg_rrule_shared_cache_hits;
+
+/**
+ * pg_rrule_shared_cache_install - Request the shared memory of the cache
+ *
+ * Called from _PG_init() while shared_preload_libraries are loaded.
+ */
+void pg_rrule_shared_cache_install(void);
+
+/**
+ * pg_rrule_shared_cache_enabled - Whether the shared cache is usable
+ *
+ * @return true if installed and pg_rrule.shared_cache_size is not 0
+ */
+bool pg_rrule_shared_cache_enabled(void);
+
+/**
+ * pg_rrule_shared_cache_lookup - Look up a result
+ *
+ * @param key Key bytes, as built by pg_rrule_cache_lookup()
+ * @param key_len Length of the key in bytes
+ * @param result Output parameter for a copy of the result, palloc'd in the
+ *               current memory context
+ * @param result_len Output parameter for the length of the result
+ * @return true on a hit
+ */
+bool pg_rrule_shared_cache_lookup(const char *key, Size key_len, char **result, Size *result_len);
+
+/**
+ * pg_rrule_shared_cache_store - Remember a result
+ *
+ * Evicts the least recently used results to make room. Results that cannot
+ * be placed are silently not cached.
+ *
+ * @param key Key bytes
+ * @param key_len Length of the key in bytes
+ * @param result Result bytes
+ * @param result_len Length of the result in bytes
+ */
+void pg_rrule_shared_cache_store(const char *key, Size key_len, const char *result, Size result_len);
+
+#endif // PG_RRULE_SHARED_CACHE_H
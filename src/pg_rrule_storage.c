@@ -0,0 +1,443 @@
+#include "pg_rrule_storage.h"
+
+#include <utils/memutils.h>
+
+typedef struct pg_rrule_reader {
+    const unsigned char *pos;
+    const unsigned char *end;
+} pg_rrule_reader;
+
+#define PG_RRULE_CORRUPT() \
+    ereport(ERROR, \
+            (errcode(ERRCODE_DATA_CORRUPTED), \
+             errmsg("invalid rrule value"), \
+             errdetail("The stored representation is truncated or malformed.")))
+
+/* Helpers */
+static void pg_rrule_write_varint(StringInfo buf, uint64 value) {
+    while (value >= 0x80) {
+        appendStringInfoCharMacro(buf, (char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    appendStringInfoCharMacro(buf, (char) value);
+}
+
+static uint32 pg_rrule_zigzag(int32 value) {
+    return ((uint32) value << 1) ^ (uint32) (value >> 31);
+}
+
+static int32 pg_rrule_unzigzag(uint32 value) {
+    return (int32) (value >> 1) ^ -(int32) (value & 1);
+}
+
+static uint8 pg_rrule_read_byte(pg_rrule_reader *reader) {
+    if (reader->pos >= reader->end) {
+        PG_RRULE_CORRUPT();
+    }
+    return *reader->pos++;
+}
+
+static uint64 pg_rrule_read_varint(pg_rrule_reader *reader) {
+    uint64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const uint8 byte = pg_rrule_read_byte(reader);
+        value |= (uint64) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    PG_RRULE_CORRUPT();
+}
+
+/* Range of the values of each BY* part, from RFC 5545 section 3.3.10; 0 is only valid where min is 0 */
+static const struct {
+    const char *name;
+    int min;
+    int max;
+} pg_rrule_by_ranges[ICAL_BY_NUM_PARTS] = {
+    [ICAL_BY_MONTH] = {"BYMONTH", 1, 12},
+    [ICAL_BY_WEEK_NO] = {"BYWEEKNO", -53, 53},
+    [ICAL_BY_YEAR_DAY] = {"BYYEARDAY", -366, 366},
+    [ICAL_BY_MONTH_DAY] = {"BYMONTHDAY", -31, 31},
+    [ICAL_BY_DAY] = {"BYDAY", 0, 0},            /* checked by weekday and position */
+    [ICAL_BY_HOUR] = {"BYHOUR", 0, 23},
+    [ICAL_BY_MINUTE] = {"BYMINUTE", 0, 59},
+    [ICAL_BY_SECOND] = {"BYSECOND", 0, 60},
+    [ICAL_BY_SET_POS] = {"BYSETPOS", -366, 366},
+};
+
+static bool pg_rrule_by_value_valid(int part, short value, bool rscale) {
+    if (part == ICAL_BY_DAY) {
+        const int weekday = icalrecurrencetype_day_day_of_week(value);
+        return weekday >= ICAL_SUNDAY_WEEKDAY && weekday <= ICAL_SATURDAY_WEEKDAY &&
+               abs(icalrecurrencetype_day_position(value)) <= 53;
+    }
+
+    if (part == ICAL_BY_MONTH) {
+        // Calendars other than the Gregorian one may have a 13th month and leap months (RFC 7529)
+        if (icalrecurrencetype_month_is_leap(value) && !rscale) {
+            return false;
+        }
+        const int month = icalrecurrencetype_month_month(value);
+        return month >= 1 && month <= (rscale ? 13 : 12);
+    }
+
+    const int min = pg_rrule_by_ranges[part].min;
+    const int max = pg_rrule_by_ranges[part].max;
+    return value >= min && value <= max && (value != 0 || min == 0);
+}
+
+const char *pg_rrule_validate(const struct icalrecurrencetype *recurrence) {
+    if ((int) recurrence->freq < ICAL_SECONDLY_RECURRENCE || (int) recurrence->freq > ICAL_NO_RECURRENCE) {
+        return "FREQ";
+    }
+    if ((int) recurrence->week_start < ICAL_NO_WEEKDAY || (int) recurrence->week_start > ICAL_SATURDAY_WEEKDAY) {
+        return "WKST";
+    }
+    if ((int) recurrence->skip < ICAL_SKIP_BACKWARD || (int) recurrence->skip > ICAL_SKIP_OMIT) {
+        return "SKIP";
+    }
+    if (recurrence->count < 0) {
+        return "COUNT";
+    }
+    if (recurrence->interval < 1) {
+        return "INTERVAL";
+    }
+
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        if (recurrence->by[i].size < 0) {
+            return pg_rrule_by_ranges[i].name;
+        }
+        if (recurrence->by[i].data == NULL) {
+            continue;
+        }
+        for (int j = 0; j < recurrence->by[i].size; j++) {
+            if (!pg_rrule_by_value_valid(i, recurrence->by[i].data[j], recurrence->rscale != NULL)) {
+                return pg_rrule_by_ranges[i].name;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void pg_rrule_decode_legacy(const char *data, Size len, struct icalrecurrencetype *recurrence) {
+    if (len < sizeof(struct icalrecurrencetype)) {
+        PG_RRULE_CORRUPT();
+    }
+
+    // Copy the base structure; with a short varlena header it is not aligned
+    memcpy(recurrence, data, sizeof(struct icalrecurrencetype));
+
+    // The zone pointer is from the process that wrote the value; rrule_in only made UTC or floating UNTILs
+    recurrence->until.zone = recurrence->until.zone != NULL ? icaltimezone_get_utc_timezone() : NULL;
+
+    // Convert offsets back to pointers, copying the by arrays out for the same reason
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        const short size = recurrence->by[i].size;
+        const size_t offset = (size_t) recurrence->by[i].data;
+
+        if (size > 0 && offset != 0) {
+            if (offset + size * sizeof(short) > len) {
+                PG_RRULE_CORRUPT();
+            }
+            recurrence->by[i].data = palloc(size * sizeof(short));
+            memcpy(recurrence->by[i].data, data + offset, size * sizeof(short));
+        } else {
+            recurrence->by[i].data = NULL;
+        }
+    }
+
+    // Convert rscale offset back to pointer
+    if (recurrence->rscale != NULL) {
+        const size_t offset = (size_t) recurrence->rscale;
+        if (offset >= len) {
+            PG_RRULE_CORRUPT();
+        }
+        recurrence->rscale = pnstrdup(data + offset, len - offset);
+    }
+
+    if (pg_rrule_validate(recurrence) != NULL) {
+        PG_RRULE_CORRUPT();
+    }
+}
+
+void pg_rrule_encode_into(StringInfo buf, const struct icalrecurrencetype *recurrence) {
+    const bool has_until = !icaltime_is_null_time(recurrence->until);
+    const int interval = recurrence->interval > 0 ? recurrence->interval : 1;
+
+    uint8 flags = 0;
+    if (recurrence->count > 0) flags |= PG_RRULE_FLAG_COUNT;
+    if (interval != 1) flags |= PG_RRULE_FLAG_INTERVAL;
+    if (has_until) flags |= PG_RRULE_FLAG_UNTIL;
+    if (has_until && recurrence->until.is_date) flags |= PG_RRULE_FLAG_UNTIL_DATE;
+    if (has_until && recurrence->until.zone == NULL) flags |= PG_RRULE_FLAG_UNTIL_FLOATING;
+    if (recurrence->rscale != NULL) flags |= PG_RRULE_FLAG_RSCALE;
+
+    uint16 parts = 0;
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        if (recurrence->by[i].size > 0 && recurrence->by[i].data != NULL) {
+            parts |= (uint16) (1 << i);
+        }
+    }
+
+    appendStringInfoCharMacro(buf, (char) PG_RRULE_FORMAT_V2);
+    appendStringInfoCharMacro(buf, (char) recurrence->freq);
+    appendStringInfoCharMacro(buf, (char) (((int) recurrence->week_start & 0x0F) | (((int) recurrence->skip & 0x0F) << 4)));
+    appendStringInfoCharMacro(buf, (char) flags);
+    appendStringInfoCharMacro(buf, (char) (parts & 0xFF));
+    appendStringInfoCharMacro(buf, (char) (parts >> 8));
+
+    if (flags & PG_RRULE_FLAG_COUNT) {
+        pg_rrule_write_varint(buf, (uint64) recurrence->count);
+    }
+
+    if (flags & PG_RRULE_FLAG_INTERVAL) {
+        pg_rrule_write_varint(buf, (uint64) interval);
+    }
+
+    if (flags & PG_RRULE_FLAG_UNTIL) {
+        // libical compares UNTIL in UTC, see pg_rrule_get_until()
+        const uint64 until_t = (uint64) (int64) icaltime_as_timet_with_zone(recurrence->until, icaltimezone_get_utc_timezone());
+        for (int shift = 0; shift < 64; shift += 8) {
+            appendStringInfoCharMacro(buf, (char) ((until_t >> shift) & 0xFF));
+        }
+    }
+
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        if (parts & (1 << i)) {
+            pg_rrule_write_varint(buf, (uint64) recurrence->by[i].size);
+            for (int j = 0; j < recurrence->by[i].size; j++) {
+                pg_rrule_write_varint(buf, pg_rrule_zigzag(recurrence->by[i].data[j]));
+            }
+        }
+    }
+
+    if (flags & PG_RRULE_FLAG_RSCALE) {
+        const size_t rscale_len = strlen(recurrence->rscale);
+        pg_rrule_write_varint(buf, (uint64) rscale_len);
+        appendBinaryStringInfo(buf, recurrence->rscale, (int) rscale_len);
+    }
+}
+
+struct varlena *pg_rrule_encode(const struct icalrecurrencetype *recurrence) {
+    StringInfoData buf;
+    initStringInfo(&buf);
+
+    appendStringInfoSpaces(&buf, VARHDRSZ);
+    pg_rrule_encode_into(&buf, recurrence);
+
+    SET_VARSIZE(buf.data, buf.len);
+    return (struct varlena *) buf.data;
+}
+
+void pg_rrule_decode(const char *data, Size len, struct icalrecurrencetype *recurrence) {
+    if (pg_rrule_is_legacy(data, len)) {
+        pg_rrule_decode_legacy(data, len, recurrence);
+        return;
+    }
+
+    pg_rrule_reader reader = {
+        .pos = (const unsigned char *) data + 1,
+        .end = (const unsigned char *) data + len,
+    };
+
+    memset(recurrence, 0, sizeof(struct icalrecurrencetype));
+    recurrence->refcount = 1;
+
+    const uint8 freq = pg_rrule_read_byte(&reader);
+    const uint8 week_start_skip = pg_rrule_read_byte(&reader);
+    const uint8 flags = pg_rrule_read_byte(&reader);
+    const uint8 parts_lo = pg_rrule_read_byte(&reader);
+    const uint16 parts = (uint16) (parts_lo | (pg_rrule_read_byte(&reader) << 8));
+
+    if (freq > ICAL_NO_RECURRENCE || (week_start_skip & 0x0F) > ICAL_SATURDAY_WEEKDAY ||
+        (week_start_skip >> 4) > ICAL_SKIP_OMIT || (parts >> ICAL_BY_NUM_PARTS) != 0) {
+        PG_RRULE_CORRUPT();
+    }
+
+    recurrence->freq = (icalrecurrencetype_frequency) freq;
+    recurrence->week_start = (icalrecurrencetype_weekday) (week_start_skip & 0x0F);
+    recurrence->skip = (icalrecurrencetype_skip) (week_start_skip >> 4);
+
+    const uint64 count = (flags & PG_RRULE_FLAG_COUNT) ? pg_rrule_read_varint(&reader) : 0;
+    const uint64 interval = (flags & PG_RRULE_FLAG_INTERVAL) ? pg_rrule_read_varint(&reader) : 1;
+    if (count > PG_INT32_MAX || interval == 0 || interval > PG_INT16_MAX) {
+        PG_RRULE_CORRUPT();
+    }
+    recurrence->count = (int) count;
+    recurrence->interval = (short) interval;
+
+    recurrence->until = icaltime_null_time();
+    if (flags & PG_RRULE_FLAG_UNTIL) {
+        uint64 until_t = 0;
+        for (int shift = 0; shift < 64; shift += 8) {
+            until_t |= (uint64) pg_rrule_read_byte(&reader) << shift;
+        }
+
+        recurrence->until = icaltime_from_timet_with_zone((time_t) (int64) until_t,
+                                                          (flags & PG_RRULE_FLAG_UNTIL_DATE) != 0,
+                                                          icaltimezone_get_utc_timezone());
+        if (flags & PG_RRULE_FLAG_UNTIL_FLOATING) {
+            recurrence->until.zone = NULL;
+        }
+    }
+
+    for (int i = 0; i < ICAL_BY_NUM_PARTS; i++) {
+        if ((parts & (1 << i)) == 0) {
+            continue;
+        }
+
+        // Every value takes at least one byte
+        const uint64 size = pg_rrule_read_varint(&reader);
+        if (size == 0 || size > PG_INT16_MAX || size > (uint64) (reader.end - reader.pos)) {
+            PG_RRULE_CORRUPT();
+        }
+
+        short *values = palloc(size * sizeof(short));
+        for (uint64 j = 0; j < size; j++) {
+            const uint64 value = pg_rrule_read_varint(&reader);
+            if (value > PG_UINT32_MAX) {
+                PG_RRULE_CORRUPT();
+            }
+
+            const int32 decoded = pg_rrule_unzigzag((uint32) value);
+            if (decoded < PG_INT16_MIN || decoded > PG_INT16_MAX) {
+                PG_RRULE_CORRUPT();
+            }
+            values[j] = (short) decoded;
+        }
+
+        recurrence->by[i].data = values;
+        recurrence->by[i].size = (short) size;
+    }
+
+    if (flags & PG_RRULE_FLAG_RSCALE) {
+        const uint64 rscale_len = pg_rrule_read_varint(&reader);
+        if (rscale_len > (uint64) (reader.end - reader.pos)) {
+            PG_RRULE_CORRUPT();
+        }
+
+        recurrence->rscale = pnstrdup((const char *) reader.pos, (Size) rscale_len);
+        reader.pos += rscale_len;
+    }
+
+    if (reader.pos != reader.end) {
+        PG_RRULE_CORRUPT();
+    }
+
+    // Values that fit the format but no rule, such as BYHOUR=25, must not reach libical either
+    if (pg_rrule_validate(recurrence) != NULL) {
+        PG_RRULE_CORRUPT();
+    }
+}
+
+static Size pg_rrule_expanded_get_flat_size(ExpandedObjectHeader *eohptr);
+static void pg_rrule_expanded_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size);
+
+static const ExpandedObjectMethods pg_rrule_expanded_methods = {
+    pg_rrule_expanded_get_flat_size,
+    pg_rrule_expanded_flatten_into
+};
+
+/* Encodes the expanded rule once, inside its own context */
+static void pg_rrule_expanded_encode(pg_rrule_expanded *expanded) {
+    if (expanded->flat != NULL) {
+        return;
+    }
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(expanded->hdr.eoh_context);
+
+    StringInfoData buf;
+    initStringInfo(&buf);
+    pg_rrule_encode_into(&buf, &expanded->recurrence);
+    expanded->flat = buf.data;
+    expanded->flat_len = buf.len;
+
+    MemoryContextSwitchTo(oldcontext);
+}
+
+static Size pg_rrule_expanded_get_flat_size(ExpandedObjectHeader *eohptr) {
+    pg_rrule_expanded *expanded = (pg_rrule_expanded *) eohptr;
+    pg_rrule_expanded_encode(expanded);
+    return VARHDRSZ + expanded->flat_len;
+}
+
+static void pg_rrule_expanded_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size) {
+    pg_rrule_expanded *expanded = (pg_rrule_expanded *) eohptr;
+    Assert(allocated_size == VARHDRSZ + expanded->flat_len);
+
+    SET_VARSIZE(result, allocated_size);
+    memcpy(VARDATA(result), expanded->flat, expanded->flat_len);
+}
+
+pg_rrule_expanded *pg_rrule_get_expanded(Datum value) {
+    if (!VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(value))) {
+        return NULL;
+    }
+
+    ExpandedObjectHeader *eohptr = DatumGetEOHP(value);
+    Assert(eohptr->eoh_methods == &pg_rrule_expanded_methods);
+    return (pg_rrule_expanded *) eohptr;
+}
+
+Datum pg_rrule_make_expanded(Datum value, MemoryContext parent) {
+    MemoryContext context = AllocSetContextCreate(parent, "expanded rrule", ALLOCSET_SMALL_SIZES);
+
+    pg_rrule_expanded *expanded = MemoryContextAllocZero(context, sizeof(pg_rrule_expanded));
+    EOH_init_header(&expanded->hdr, &pg_rrule_expanded_methods, context);
+
+    pg_rrule_expanded *source = pg_rrule_get_expanded(value);
+    if (source != NULL) {
+        pg_rrule_expanded_encode(source);
+    }
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(context);
+
+    // Decoding allocates the BY* arrays in the current context, i.e. the object's
+    if (source != NULL) {
+        pg_rrule_decode(source->flat, source->flat_len, &expanded->recurrence);
+    } else {
+        struct varlena *flat = (struct varlena *) PG_DETOAST_DATUM_PACKED(value);
+        pg_rrule_decode(VARDATA_ANY(flat), VARSIZE_ANY_EXHDR(flat), &expanded->recurrence);
+        if ((Pointer) flat != DatumGetPointer(value)) {
+            pfree(flat);
+        }
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    return EOHPGetRWDatum(&expanded->hdr);
+}
+
+struct varlena *pg_rrule_detoast(Datum value) {
+    if (VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(value))) {
+        return (struct varlena *) DatumGetPointer(value);
+    }
+    return (struct varlena *) PG_DETOAST_DATUM_PACKED(value);
+}
+
+const char *pg_rrule_canonical(const struct varlena *value, Size *len) {
+    pg_rrule_expanded *expanded = pg_rrule_get_expanded(PointerGetDatum(value));
+    if (expanded != NULL) {
+        pg_rrule_expanded_encode(expanded);
+        *len = expanded->flat_len;
+        return expanded->flat;
+    }
+
+    const char *data = VARDATA_ANY(value);
+    *len = VARSIZE_ANY_EXHDR(value);
+
+    if (!pg_rrule_is_legacy(data, *len)) {
+        return data;
+    }
+
+    struct icalrecurrencetype tmp;
+    pg_rrule_decode(data, *len, &tmp);
+
+    StringInfoData buf;
+    initStringInfo(&buf);
+    pg_rrule_encode_into(&buf, &tmp);
+
+    *len = buf.len;
+    return buf.data;
+}
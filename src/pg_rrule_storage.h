@@ -0,0 +1,173 @@
+#ifndef PG_RRULE_STORAGE_H
+#define PG_RRULE_STORAGE_H
+
+#include <libical/ical.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <utils/expandeddatum.h>
+
+/* ========================================================================
+ * On-Disk Format
+ *
+ * Version 2 (current), after the varlena header:
+ *
+ *   byte 0     PG_RRULE_FORMAT_V2
+ *   byte 1     FREQ (icalrecurrencetype_frequency)
+ *   byte 2     WKST in the low nibble, SKIP in the high nibble
+ *   byte 3     PG_RRULE_FLAG_* bits
+ *   bytes 4-5  presence bitmask of the BY* parts, little-endian, bit n for
+ *              icalrecurrencetype_byrule n
+ *   varint     COUNT, if PG_RRULE_FLAG_COUNT
+ *   varint     INTERVAL, if PG_RRULE_FLAG_INTERVAL (absent means 1)
+ *   8 bytes    UNTIL as epoch seconds, little-endian, if PG_RRULE_FLAG_UNTIL
+ *   per BY* part present, in icalrecurrencetype_byrule order:
+ *     varint   number of values
+ *     varints  zigzag-coded values
+ *   varint + bytes  RSCALE, if PG_RRULE_FLAG_RSCALE
+ *
+ * Varints are unsigned LEB128. Every field is byte-aligned and the layout
+ * does not depend on the architecture or on libical's struct layout.
+ *
+ * Version 1 (legacy) is a memcpy of struct icalrecurrencetype, pointers
+ * replaced by offsets, followed by the BY* arrays and RSCALE. It starts
+ * with the 4-byte FREQ enum, whose first byte is at most 7 (little-endian)
+ * or 0 (big-endian), so it can never be mistaken for the version byte.
+ * Legacy values are still decoded; they are rewritten in the new format
+ * whenever a value is produced again (UPDATE, dump and restore, ...).
+ * ======================================================================== */
+
+#define PG_RRULE_FORMAT_V2 0xA2
+
+#define PG_RRULE_FLAG_COUNT 0x01
+#define PG_RRULE_FLAG_INTERVAL 0x02
+#define PG_RRULE_FLAG_UNTIL 0x04
+#define PG_RRULE_FLAG_UNTIL_DATE 0x08      /* UNTIL is a DATE */
+#define PG_RRULE_FLAG_UNTIL_FLOATING 0x10  /* UNTIL has no zone */
+#define PG_RRULE_FLAG_RSCALE 0x20
+
+/*
+ * The type uses extended storage, so arguments may arrive compressed, out
+ * of line or with a 1-byte header, or as an expanded object (see below).
+ * Fetch them with PG_GETARG_RRULE_P and read them with flatten_to_tmp() or
+ * pg_rrule_canonical(); plain values, the common case, and expanded objects
+ * are returned as is without copying. PG_GETARG_RRULE_FLAT_P never returns
+ * an expanded object: compressed and external values are copied into the
+ * current memory context, while plain in-line values are returned in place
+ * and must not be modified.
+ */
+#define PG_GETARG_RRULE_P(n) pg_rrule_detoast(PG_GETARG_DATUM(n))
+#define PG_GETARG_RRULE_FLAT_P(n) ((struct varlena *) PG_DETOAST_DATUM_PACKED(PG_GETARG_DATUM(n)))
+
+/* ========================================================================
+ * Expanded Form
+ *
+ * A decoded rule kept in its own memory context, following PostgreSQL's
+ * expanded object protocol. A PL/pgSQL variable holding one is passed to
+ * functions as a read-only pointer, so a dozen accessors on the same
+ * variable decode the rule once instead of a dozen times. The canonical
+ * encoding is computed on first use and reused for comparisons, hashing
+ * and whenever the value is stored.
+ * ======================================================================== */
+
+typedef struct pg_rrule_expanded {
+    ExpandedObjectHeader hdr;
+    struct icalrecurrencetype recurrence;   /* BY* arrays and RSCALE in hdr.eoh_context */
+    char *flat;                             /* canonical encoding, NULL until needed */
+    Size flat_len;
+} pg_rrule_expanded;
+
+/**
+ * pg_rrule_make_expanded - Expand a stored rule
+ *
+ * @param value rrule datum, in any form
+ * @param parent Memory context the expanded object's context is created under
+ * @return Read-write pointer to the new expanded object
+ */
+Datum pg_rrule_make_expanded(Datum value, MemoryContext parent);
+
+/**
+ * pg_rrule_get_expanded - The expanded object behind a datum, if any
+ *
+ * @param value rrule datum, in any form
+ * @return The expanded object, or NULL for flat values
+ */
+pg_rrule_expanded *pg_rrule_get_expanded(Datum value);
+
+/**
+ * pg_rrule_detoast - Make a stored rule readable, keeping expanded objects
+ *
+ * @param value rrule datum, in any form
+ * @return Pointer to a varlena with any header, or to an expanded object
+ */
+struct varlena *pg_rrule_detoast(Datum value);
+
+/**
+ * pg_rrule_encode - Serialize a rule in the current on-disk format
+ *
+ * @param recurrence The icalrecurrencetype structure
+ * @return Newly palloc'd varlena
+ */
+struct varlena *pg_rrule_encode(const struct icalrecurrencetype *recurrence);
+
+/**
+ * pg_rrule_encode_into - Append the current format, without varlena header, to a buffer
+ *
+ * @param buf Buffer to append to
+ * @param recurrence The icalrecurrencetype structure
+ */
+void pg_rrule_encode_into(StringInfo buf, const struct icalrecurrencetype *recurrence);
+
+/**
+ * pg_rrule_validate - Check the fields of a rule against their ranges
+ *
+ * Covers FREQ, WKST, SKIP, COUNT, INTERVAL and every BY* value, e.g.
+ * BYHOUR 0 to 23 or BYMONTHDAY -31 to 31 without 0. Every rule that is
+ * encoded passes it, so pg_rrule_decode() can reject those that don't.
+ *
+ * @param recurrence The rule to check
+ * @return NULL if the rule is valid, else the name of the first field out of range
+ */
+const char *pg_rrule_validate(const struct icalrecurrencetype *recurrence);
+
+/**
+ * pg_rrule_decode - Read a stored rule in either format
+ *
+ * The BY* arrays and RSCALE of `recurrence` are palloc'd in the current
+ * memory context, never pointing into `data`, which need not be aligned.
+ * They must not be freed by libical.
+ *
+ * @param data Payload of the varlena (VARDATA_ANY)
+ * @param len Payload length in bytes (VARSIZE_ANY_EXHDR)
+ * @param recurrence Output parameter for the decoded rule
+ * @throws ERROR if the payload is malformed or a field is out of range
+ */
+void pg_rrule_decode(const char *data, Size len, struct icalrecurrencetype *recurrence);
+
+/**
+ * pg_rrule_canonical - Canonical byte form of a stored rule
+ *
+ * Equal rules have identical canonical bytes, so equality, ordering and
+ * hashing work on these bytes. Values in the current format already are in
+ * canonical form and are returned in place; legacy values are re-encoded.
+ *
+ * @param value Stored rule, fetched with PG_GETARG_RRULE_P (may be expanded)
+ * @param len Output parameter for the length in bytes
+ * @return Pointer to the canonical bytes (no varlena header)
+ * @throws ERROR if the stored value is malformed
+ */
+const char *pg_rrule_canonical(const struct varlena *value, Size *len);
+
+/**
+ * pg_rrule_is_legacy - Whether a payload uses the legacy format
+ *
+ * @param data Payload of the varlena (after the header)
+ * @param len Payload length in bytes
+ * @return true for the legacy (version 1) layout
+ */
+static inline bool pg_rrule_is_legacy(const char *data, Size len) {
+    return len == 0 || (unsigned char) data[0] != PG_RRULE_FORMAT_V2;
+}
+
+#endif // PG_RRULE_STORAGE_H
@@ -0,0 +1,58 @@
+-- Parallel scan workload: serial versus parallel plans over a large events table.
+--
+--   psql -d <db> -f test/bench/parallel_scan.sql
+--
+-- Needs the extension installed. Runs the same scan with 0 and 4 workers
+-- (each twice, keeping the faster run, so the cache of the first run doesn't
+-- favour the second plan) and prints both execution times, the workers
+-- actually launched, the speedup and whether both plans counted the same
+-- rows as one row. A Gather that launches no worker or a parallel plan that
+-- counts differently means the functions are not safe to run in workers.
+SET client_min_messages = warning;
+
+DROP TABLE IF EXISTS bench_events;
+CREATE TABLE bench_events AS
+SELECT g AS id,
+       (ARRAY['FREQ=DAILY;BYHOUR=9,17',
+              'FREQ=WEEKLY;BYDAY=MO,WE,FR;BYHOUR=8;BYMINUTE=30',
+              'FREQ=MONTHLY;BYMONTHDAY=1,15',
+              'FREQ=WEEKLY;INTERVAL=2;BYDAY=TU,TH;COUNT=100',
+              'FREQ=YEARLY;BYMONTH=1,4,7,10;BYMONTHDAY=1'])[1 + g % 5]::rrule AS rule,
+       timestamptz '2020-01-01 00:00:00+00' + (g % 1000) * interval '1 day' AS dtstart
+FROM generate_series(1, 2000000) AS g;
+ANALYZE bench_events;
+
+-- Force parallel plans for the comparison even on small machines
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+
+CREATE FUNCTION pg_temp.scan(workers integer, OUT ms float8, OUT launched integer, OUT matches bigint) LANGUAGE plpgsql AS $$
+DECLARE
+    query constant text := $q$SELECT count(*)
+                              FROM bench_events
+                              WHERE rrule_count_occurrences(rule, dtstart, '2024-01-01 00:00:00+00', '2024-03-31 23:59:59+00') > 20$q$;
+    plan jsonb;
+BEGIN
+    PERFORM set_config('max_parallel_workers_per_gather', workers::text, true);
+    ms := 'Infinity';
+    FOR run IN 1..2 LOOP
+        EXECUTE 'EXPLAIN (ANALYZE, FORMAT JSON) ' || query INTO plan;
+        ms := least(ms, (plan->0->>'Execution Time')::float8);
+        launched := coalesce(jsonb_path_query_first(plan, '$.**."Workers Launched"')::integer, 0);
+    END LOOP;
+    EXECUTE query INTO matches;
+END
+$$;
+
+SELECT * FROM pg_temp.scan(0) \gset serial_
+SELECT * FROM pg_temp.scan(4) \gset parallel_
+
+SELECT round(:serial_ms::numeric, 1) AS serial_ms,
+       round(:parallel_ms::numeric, 1) AS parallel_ms,
+       :parallel_launched AS workers_launched,
+       round((:serial_ms / :parallel_ms)::numeric, 2) AS speedup,
+       :serial_matches = :parallel_matches AS same_result;
+
+RESET ALL;
+DROP TABLE bench_events;
@@ -0,0 +1,10 @@
+-- Property accessors on 100 stored rules
+\set id random(1, :nrules - 99)
+SELECT count(*) FILTER (WHERE get_freq(rule) = 'WEEKLY'),
+       sum(get_interval(rule)),
+       sum(coalesce(get_count(rule), 0)),
+       count(get_until(rule)),
+       sum(cardinality(get_byday(rule))),
+       sum(cardinality(get_bymonthday(rule))),
+       sum(cardinality(get_byhour(rule)))
+FROM bench_rules WHERE id BETWEEN :id AND :id + 99;
@@ -0,0 +1,4 @@
+-- get_occurrences() with timezone: 10 rules, 90 days from their DTSTART
+\set id random(1, :nrules - 9)
+SELECT sum(cardinality(get_occurrences(rule, dtstart, dtstart + interval '90 days')))
+FROM bench_rules WHERE id BETWEEN :id AND :id + 9;
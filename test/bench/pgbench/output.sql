@@ -0,0 +1,3 @@
+-- Text output: 100 stored rules through rrule_out
+\set id random(1, :nrules - 99)
+SELECT sum(length(rule::text)) FROM bench_rules WHERE id BETWEEN :id AND :id + 99;
@@ -0,0 +1,3 @@
+-- Text input: 100 rules of the mix through rrule_in
+\set id random(1, :nrules - 99)
+SELECT count(rule_text::rrule) FROM bench_rules WHERE id BETWEEN :id AND :id + 99;
@@ -0,0 +1,10 @@
+-- Window queries: a random week, expanded for 10 rules, then looked up over the whole table
+\set id random(1, :nrules - 9)
+\set day random(0, 720)
+SELECT sum(cardinality(get_occurrences(rule, dtstart,
+                                       timestamptz '2024-01-01 00:00:00+00' + :day * interval '1 day',
+                                       timestamptz '2024-01-08 00:00:00+00' + :day * interval '1 day')))
+FROM bench_rules WHERE id BETWEEN :id AND :id + 9;
+SELECT count(*) FROM bench_rules
+WHERE series && tstzrange(timestamptz '2024-01-01 00:00:00+00' + :day * interval '1 day',
+                          timestamptz '2024-01-08 00:00:00+00' + :day * interval '1 day');
@@ -0,0 +1,146 @@
+#!/usr/bin/env bash
+# Runs the pgbench workloads of test/bench/pgbench against a throwaway cluster.
+#
+#   test/bench/run.sh [--pg-config PATH] [--install] [--library PATH] [workload ...]
+#
+# Creates a cluster in a temporary directory with the PostgreSQL of
+# pg_config, loads the rule mix of setup.sql and runs every workload, or only
+# those named, for BENCH_DURATION seconds each. Prints transactions per second
+# and latency percentiles per workload; the cluster is removed on exit. Must
+# not run as root, like initdb.
+#
+# Without --install, the pg_rrule already installed in that PostgreSQL is
+# measured. With --install, the library of --library, the control file and
+# the SQL script are copied into it first, replacing any installed pg_rrule;
+# this is meant for a private PostgreSQL build owned by the current user, and
+# fails early when its directories are not writable. `make bench` installs the
+# library just built into the PostgreSQL of the PG_CONFIG CMake variable.
+#
+# Environment:
+#   BENCH_DURATION  seconds per workload (default 30)
+#   BENCH_CLIENTS   pgbench clients (default 4)
+#   BENCH_JOBS      pgbench threads (default BENCH_CLIENTS)
+#   BENCH_SCALE     thousands of rules in bench_rules (default 10)
+#   BENCH_PORT      port of the cluster (default 54329)
+#   BENCH_KEEP      keep the cluster directory, with pgbench logs and the server log, when set
+set -euo pipefail
+
+bench_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+root_dir="$(cd "$bench_dir/../.." && pwd)"
+
+pg_config="$(command -v pg_config || true)"
+library="$root_dir/build/pg_rrule.so"
+install=false
+workloads=()
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --pg-config) pg_config="$2"; shift 2 ;;
+        --library) library="$2"; shift 2 ;;
+        --install) install=true; shift ;;
+        -h|--help) sed -n '2,25p' "$0" | sed 's/^# \{0,1\}//'; exit 0 ;;
+        *) workloads+=("$1"); shift ;;
+    esac
+done
+
+if [ ${#workloads[@]} -eq 0 ]; then
+    for file in "$bench_dir"/pgbench/*.sql; do
+        workloads+=("$(basename "$file" .sql)")
+    done
+fi
+
+duration="${BENCH_DURATION:-30}"
+clients="${BENCH_CLIENTS:-4}"
+jobs="${BENCH_JOBS:-$clients}"
+scale="${BENCH_SCALE:-10}"
+port="${BENCH_PORT:-54329}"
+nrules=$((scale * 1000))
+
+if [ -z "$pg_config" ] || [ ! -x "$pg_config" ]; then
+    echo "pg_config not found; pass --pg-config" >&2
+    exit 1
+fi
+if [ "$(id -u)" -eq 0 ]; then
+    echo "initdb can't run as root; run the benchmark as an unprivileged user" >&2
+    exit 1
+fi
+
+bindir="$("$pg_config" --bindir)"
+pkglib_dir="$("$pg_config" --pkglibdir)"
+extension_dir="$("$pg_config" --sharedir)/extension"
+
+# Install
+if $install; then
+    if [ ! -f "$library" ]; then
+        echo "$library not found; build the extension or pass --library" >&2
+        exit 1
+    fi
+    for dir in "$pkglib_dir" "$extension_dir"; do
+        if [ ! -w "$dir" ]; then
+            echo "$dir is not writable; --install needs a private PostgreSQL build owned by $(id -un)," >&2
+            echo "passed with --pg-config (for make bench: cmake -DPG_CONFIG=<prefix>/bin/pg_config)" >&2
+            exit 1
+        fi
+    done
+
+    version="$(sed -n "s/^default_version = '\(.*\)'/\1/p" "$root_dir/pg_rrule.control")"
+    install -m 755 "$library" "$pkglib_dir/pg_rrule.so"
+    install -m 644 "$root_dir/pg_rrule.control" "$extension_dir/pg_rrule.control"
+    install -m 644 "$root_dir/sql/pg_rrule.sql" "$extension_dir/pg_rrule--$version.sql"
+    install -m 644 "$root_dir"/sql/pg_rrule--*--*.sql "$extension_dir/"
+elif [ ! -f "$extension_dir/pg_rrule.control" ]; then
+    echo "pg_rrule is not installed in $("$pg_config" --sharedir); install it or pass --install" >&2
+    exit 1
+fi
+
+# Cluster
+work_dir="$(mktemp -d "${TMPDIR:-/tmp}/pg_rrule_bench.XXXXXX")"
+cleanup() {
+    "$bindir/pg_ctl" -D "$work_dir/data" -m immediate stop >/dev/null 2>&1 || true
+    if [ -n "${BENCH_KEEP:-}" ]; then
+        echo "Cluster directory kept in $work_dir"
+    else
+        rm -rf "$work_dir"
+    fi
+}
+trap cleanup EXIT
+
+"$bindir/initdb" -D "$work_dir/data" -U postgres -A trust -E UTF8 --no-sync >"$work_dir/initdb.log"
+"$bindir/pg_ctl" -D "$work_dir/data" -l "$work_dir/server.log" -w \
+    -o "-p $port -k $work_dir -c listen_addresses='' -c max_connections=$((clients + 10))" start >/dev/null
+
+connection=(-h "$work_dir" -p "$port" -U postgres)
+psql=("$bindir/psql" -X -q -v ON_ERROR_STOP=1 "${connection[@]}" -d postgres)
+
+"${psql[@]}" -c "CREATE EXTENSION pg_rrule"
+"${psql[@]}" -v scale="$scale" -f "$bench_dir/setup.sql"
+
+# Workloads
+printf '%d rules, %d clients, %d threads, %ds per workload\n\n' "$nrules" "$clients" "$jobs" "$duration"
+printf '%-16s %12s %10s %10s %10s %10s\n' workload tps "avg ms" "p50 ms" "p95 ms" "p99 ms"
+
+for workload in "${workloads[@]}"; do
+    script="$bench_dir/pgbench/$workload.sql"
+    if [ ! -f "$script" ]; then
+        echo "unknown workload: $workload" >&2
+        exit 1
+    fi
+
+    "$bindir/pgbench" "${connection[@]}" -n -M prepared -c "$clients" -j "$jobs" -T "$duration" \
+        -D nrules="$nrules" -l --log-prefix="$work_dir/$workload" -f "$script" postgres >"$work_dir/$workload.out"
+
+    tps="$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' "$work_dir/$workload.out" | tail -n 1)"
+
+    # One per-transaction log per thread, none when no client ran; the third field is the latency in microseconds
+    shopt -s nullglob
+    logs=("$work_dir/$workload".[0-9]*)
+    shopt -u nullglob
+    awk '{ print $3 }' /dev/null "${logs[@]}" | sort -n | awk -v tps="$tps" -v name="$workload" '
+        { latency[NR] = $1; sum += $1 }
+        function percentile(p) { return latency[int((NR - 1) * p) + 1] / 1000 }
+        END {
+            if (NR == 0) { printf "%-16s %12s\n", name, "no transactions"; exit }
+            printf "%-16s %12.1f %10.3f %10.3f %10.3f %10.3f\n", name, tps, sum / NR / 1000,
+                   percentile(0.50), percentile(0.95), percentile(0.99)
+        }'
+done
@@ -0,0 +1,69 @@
+-- Rule mix of the pgbench workloads, run by run.sh before them.
+--
+--   psql -d <db> -v scale=10 -f test/bench/setup.sql
+--
+-- Creates bench_rules with scale * 1000 rows. The mix follows what calendars
+-- and schedulers store: weekly meetings, daily reminders, billing days,
+-- "second Tuesday" and "last working day" rules, anniversaries and a few
+-- sub-daily ones. About 40% never end, 30% have a COUNT and 30% an UNTIL.
+-- The seed is fixed, so every run and every build sees the same rules.
+SET client_min_messages = warning;
+SET TimeZone = 'UTC';
+
+DROP TABLE IF EXISTS bench_rules;
+CREATE TABLE bench_rules (
+    id integer PRIMARY KEY,
+    rule_text text NOT NULL,
+    rule rrule NOT NULL,
+    dtstart timestamp with time zone NOT NULL,
+    dtstart_local timestamp NOT NULL,
+    series rrule_series NOT NULL
+);
+
+SELECT setseed(0.25);
+
+WITH draws AS (
+    SELECT i,
+           random() AS kind,
+           random() AS ending,
+           date_trunc('minute', timestamptz '2024-01-01 00:00:00+00' + random() * interval '730 days') AS dtstart,
+           (ARRAY['MO', 'TU', 'WE', 'TH', 'FR', 'MO,WE,FR', 'TU,TH', 'MO,TU,WE,TH,FR', 'SA,SU'])[1 + floor(random() * 9)::int] AS days,
+           (ARRAY['1', '2', '3', '4', '-1'])[1 + floor(random() * 5)::int] AS position,
+           1 + floor(random() * 12)::int AS month,
+           1 + floor(random() * 28)::int AS monthday,
+           7 + floor(random() * 12)::int AS hour,
+           (ARRAY[0, 15, 30, 45])[1 + floor(random() * 4)::int] AS minute,
+           1 + floor(random() * 4)::int AS step,
+           5 + floor(random() * 200)::int AS count,
+           30 + floor(random() * 700)::int AS lifetime
+    FROM generate_series(1, :scale * 1000) AS i
+), rules AS (
+    SELECT i,
+           dtstart,
+           concat_ws(';',
+               CASE
+                   WHEN kind < 0.25 THEN format('FREQ=WEEKLY;BYDAY=%s;BYHOUR=%s;BYMINUTE=%s', days, hour, minute)
+                   WHEN kind < 0.40 THEN format('FREQ=DAILY;BYHOUR=%s;BYMINUTE=%s', hour, minute)
+                   WHEN kind < 0.50 THEN format('FREQ=DAILY;INTERVAL=%s', step)
+                   WHEN kind < 0.65 THEN format('FREQ=MONTHLY;BYMONTHDAY=%s', monthday)
+                   WHEN kind < 0.75 THEN format('FREQ=MONTHLY;BYDAY=%s%s', position, left(days, 2))
+                   WHEN kind < 0.80 THEN 'FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1'
+                   WHEN kind < 0.90 THEN format('FREQ=YEARLY;BYMONTH=%s;BYMONTHDAY=%s', month, monthday)
+                   WHEN kind < 0.95 THEN format('FREQ=WEEKLY;INTERVAL=2;BYDAY=%s;BYHOUR=%s', days, hour)
+                   ELSE format('FREQ=HOURLY;INTERVAL=%s', step)
+               END,
+               CASE
+                   WHEN ending < 0.40 THEN NULL
+                   WHEN ending < 0.70 THEN format('COUNT=%s', count)
+                   ELSE format('UNTIL=%s', to_char(dtstart + lifetime * interval '1 day', 'YYYYMMDD"T"HH24MISS"Z"'))
+               END) AS rule_text
+    FROM draws
+)
+INSERT INTO bench_rules
+SELECT i, rule_text, rule_text::rrule, dtstart, dtstart AT TIME ZONE 'UTC', rrule_series(rule_text::rrule, dtstart, interval '1 hour')
+FROM rules;
+
+CREATE INDEX ON bench_rules USING gist (series);
+ANALYZE bench_rules;
+
+RESET ALL;
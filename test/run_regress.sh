@@ -0,0 +1,111 @@
+#!/usr/bin/env bash
+# Runs the regression tests of test/sql against a throwaway cluster.
+#
+#   test/run_regress.sh [--pg-config PATH] [--library PATH] [--update] [test ...]
+#
+# Creates a cluster in a temporary directory with the PostgreSQL of
+# pg_config and runs every test, or only those named, through psql the way
+# pg_regress does: input echoed, Postgres date style, messages in English.
+# The tests load sql/pg_rrule.sql themselves; it is copied with
+# MODULE_PATHNAME replaced by the library of --library, so nothing is
+# installed into PostgreSQL. Must not run as root, like initdb.
+#
+# Each output is compared with test/expected; differences are printed and
+# make the script fail. With --update, the outputs replace the expected
+# files instead, to be reviewed with git diff.
+#
+# Environment:
+#   REGRESS_PORT  port of the cluster (default 54328)
+#   REGRESS_KEEP  keep the cluster directory, with outputs and the server log, when set
+set -euo pipefail
+
+test_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+root_dir="$(cd "$test_dir/.." && pwd)"
+
+pg_config="$(command -v pg_config || true)"
+library="$root_dir/build/pg_rrule.so"
+update=false
+tests=()
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --pg-config) pg_config="$2"; shift 2 ;;
+        --library) library="$2"; shift 2 ;;
+        --update) update=true; shift ;;
+        -h|--help) sed -n '2,19p' "$0" | sed 's/^# \{0,1\}//'; exit 0 ;;
+        *) tests+=("$1"); shift ;;
+    esac
+done
+
+if [ ${#tests[@]} -eq 0 ]; then
+    for file in "$test_dir"/sql/*.sql; do
+        tests+=("$(basename "$file" .sql)")
+    done
+fi
+
+port="${REGRESS_PORT:-54328}"
+
+if [ -z "$pg_config" ] || [ ! -x "$pg_config" ]; then
+    echo "pg_config not found; pass --pg-config" >&2
+    exit 1
+fi
+if [ ! -f "$library" ]; then
+    echo "$library not found; build the extension or pass --library" >&2
+    exit 1
+fi
+if [ "$(id -u)" -eq 0 ]; then
+    echo "initdb can't run as root; run the tests as an unprivileged user" >&2
+    exit 1
+fi
+
+bindir="$("$pg_config" --bindir)"
+library="$(cd "$(dirname "$library")" && pwd)/$(basename "$library")"
+
+# Cluster
+work_dir="$(mktemp -d "${TMPDIR:-/tmp}/pg_rrule_regress.XXXXXX")"
+cleanup() {
+    "$bindir/pg_ctl" -D "$work_dir/data" -m immediate stop >/dev/null 2>&1 || true
+    if [ -n "${REGRESS_KEEP:-}" ]; then
+        echo "Cluster directory kept in $work_dir"
+    else
+        rm -rf "$work_dir"
+    fi
+}
+trap cleanup EXIT
+
+"$bindir/initdb" -D "$work_dir/data" -U postgres -A trust --no-locale -E UTF8 --no-sync >"$work_dir/initdb.log"
+"$bindir/pg_ctl" -D "$work_dir/data" -l "$work_dir/server.log" -w \
+    -o "-p $port -k $work_dir -c listen_addresses='' -c lc_messages=C" start >/dev/null
+
+# The tests run from a directory holding sql/pg_rrule.sql, the path they load it from
+mkdir -p "$work_dir/run/sql" "$work_dir/results"
+sed "s|MODULE_PATHNAME|$library|g" "$root_dir/sql/pg_rrule.sql" >"$work_dir/run/sql/pg_rrule.sql"
+
+export PGTZ=PST8PDT PGDATESTYLE='Postgres, MDY' LC_MESSAGES=C
+connection=(-h "$work_dir" -p "$port" -U postgres)
+
+failed=0
+for test in "${tests[@]}"; do
+    script="$test_dir/sql/$test.sql"
+    if [ ! -f "$script" ]; then
+        echo "unknown test: $test" >&2
+        exit 1
+    fi
+
+    "$bindir/dropdb" "${connection[@]}" --if-exists regression
+    "$bindir/createdb" "${connection[@]}" regression
+    (cd "$work_dir/run" && "$bindir/psql" -X -a -q "${connection[@]}" -d regression <"$script" >"$work_dir/results/$test.out" 2>&1) || true
+
+    if $update; then
+        cp "$work_dir/results/$test.out" "$test_dir/expected/$test.out"
+        printf '%-12s updated\n' "$test"
+    elif diff -u "$test_dir/expected/$test.out" "$work_dir/results/$test.out" >"$work_dir/results/$test.diff"; then
+        printf '%-12s ok\n' "$test"
+    else
+        printf '%-12s FAILED\n' "$test"
+        cat "$work_dir/results/$test.diff"
+        failed=1
+    fi
+done
+
+exit $failed
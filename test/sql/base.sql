@@ -32,4 +32,263 @@ WITH occurrences AS (
 )
 SELECT * FROM occurrences;
 
+SELECT * FROM rrule_occurrences('FREQ=DAILY;BYHOUR=09;'::rrule, '2024-05-25 00:00:00'::timestamp) LIMIT 3;
+
+SELECT * FROM
+    unnest(
+        get_occurrences('FREQ=WEEKLY;BYDAY=MO;BYHOUR=9;BYMINUTE=0;BYSECOND=0'::rrule,
+            '2012-01-02 09:00:00'::timestamp, '2024-05-20 00:00:00'::timestamp, '2024-06-02 00:00:00'::timestamp)
+    );
+
+SELECT * FROM
+    unnest(
+        get_occurrences('FREQ=DAILY;COUNT=5'::rrule,
+            '2024-01-01 10:00:00'::timestamp, '2024-01-04 00:00:00'::timestamp, '2024-01-10 00:00:00'::timestamp)
+    );
+
+SELECT rrule_next_occurrence('FREQ=DAILY;BYHOUR=09;'::rrule, '2012-01-01 00:00:00'::timestamp, '2024-05-25 09:00:00'::timestamp);
+
+SELECT * FROM
+    unnest(
+        rrule_next_occurrences('FREQ=WEEKLY;BYDAY=MO;BYHOUR=9;BYMINUTE=0;BYSECOND=0'::rrule,
+            '2012-01-02 09:00:00'::timestamp, '2024-05-21 00:00:00'::timestamp, 3)
+    );
+
+SELECT rrule_count_occurrences('FREQ=DAILY;INTERVAL=2'::rrule,
+    '2024-01-01 10:00:00'::timestamp, '2024-01-02 00:00:00'::timestamp, '2024-01-31 00:00:00'::timestamp);
+
+SELECT rrule_count_occurrences('FREQ=WEEKLY;BYDAY=MO,WE'::rrule,
+    '2024-01-01 10:00:00'::timestamp, '2024-01-01 00:00:00'::timestamp, '2024-01-31 23:59:59'::timestamp);
+
+SELECT rrule_occurs_at('FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;BYHOUR=9;BYMINUTE=0;BYSECOND=0'::rrule,
+    '2024-01-01 09:00:00'::timestamp, '2024-01-17 09:00:00'::timestamp);
+
+SELECT rrule_occurs_at('FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;BYHOUR=9;BYMINUTE=0;BYSECOND=0'::rrule,
+    '2024-01-01 09:00:00'::timestamp, '2024-01-10 09:00:00'::timestamp);
+
+SELECT (get_occurrences('FREQ=DAILY;COUNT=2'::rrule, '2024-01-01 10:00:00.5'::timestamp))[1] AS first,
+       rrule_occurs_at('FREQ=DAILY;COUNT=2'::rrule, '2024-01-01 10:00:00.5'::timestamp, '2024-01-01 10:00:00'::timestamp) AS occurs;
+
+SELECT rrule_span('FREQ=DAILY;COUNT=5'::rrule, '2024-05-25 09:00:00'::timestamp);
+
+SELECT rrule_span('FREQ=MONTHLY;BYMONTHDAY=15;UNTIL=20241231T000000Z'::rrule, '2024-05-25 09:00:00'::timestamp);
+
+SELECT rrule_span('FREQ=WEEKLY;BYDAY=SA,SU'::rrule, '2024-05-25 09:00:00'::timestamp);
+
+SET LOCAL timezone = 'Europe/Berlin';
+
+SELECT get_occurrences('FREQ=WEEKLY;COUNT=3'::rrule, '2024-03-22 09:00:00'::timestamp with time zone);
+
+SET LOCAL timezone = 'UTC';
+
+SELECT get_occurrences_tz('FREQ=WEEKLY;COUNT=3'::rrule, '2024-03-22 08:00:00+00'::timestamp with time zone, 'Europe/Berlin');
+
+SELECT rrule_span_tz('FREQ=WEEKLY;COUNT=3'::rrule, '2024-03-22 08:00:00+00'::timestamp with time zone, 'Europe/Berlin') AS berlin,
+       rrule_span('FREQ=WEEKLY;COUNT=3'::rrule, '2024-03-22 08:00:00+00'::timestamp with time zone) AS session;
+
+SELECT pg_column_size('FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9'::rrule);
+
+SELECT rrule_send('FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9'::rrule);
+
+CREATE TEMP TABLE rrule_storage (rule rrule);
+
+INSERT INTO rrule_storage VALUES ('FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9');
+
+SELECT pg_column_size(rule), get_freq(rule), get_byhour(rule) FROM rrule_storage;
+
+-- rrule_recv validates what it stores; a binary COPY of bytea passes its bytes through as they are
+CREATE TEMP TABLE rrule_wire (label text, payload bytea);
+
+INSERT INTO rrule_wire VALUES
+    ('v2', '\xa204220030000204080112'),
+    ('v2 BYHOUR=25', '\xa204220030000204080132'),
+    ('v2 BYHOUR=40000', '\xa204220030000204080180f104'),
+    ('legacy', '\x0000000100000004000000000001000000020000000200000000000000000000000000000000000000000000000000000000ffffffff000000000000000000020002000400010009000000000000'),
+    ('legacy FREQ=300', '\x000000010000012c000000000001000000020000000200000000000000000000000000000000000000000000000000000000ffffffff000000000000000000020002000400010009000000000000'),
+    ('legacy BYHOUR=25', '\x0000000100000004000000000001000000020000000200000000000000000000000000000000000000000000000000000000ffffffff000000000000000000020002000400010019000000000000'),
+    ('legacy UNTIL month 13', '\x00000001000000040000000000010000000200000002000007e80000000d0000000100000000000000000000000000000000ffffffff000000000000000000020002000400010009000000000000'),
+    ('legacy trailing byte', '\x0000000100000004000000000001000000020000000200000000000000000000000000000000000000000000000000000000ffffffff00000000000000000002000200040001000900000000000000');
+
+CREATE TEMP TABLE rrule_recv_test (rule rrule);
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'v2') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'legacy') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+SELECT count(*) AS rules, bool_and(rule = 'FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9'::rrule) AS same FROM rrule_recv_test;
+
+SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'v2 BYHOUR=25') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'v2 BYHOUR=40000') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'legacy FREQ=300') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'legacy BYHOUR=25') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'legacy UNTIL month 13') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\copy (SELECT payload FROM rrule_wire WHERE label = 'legacy trailing byte') TO 'rrule_wire.bin' (FORMAT binary)
+\copy rrule_recv_test FROM 'rrule_wire.bin' (FORMAT binary)
+
+ROLLBACK TO SAVEPOINT wire;
+
+\! rm rrule_wire.bin
+
+SELECT 'FREQ=WEEKLY;INTERVAL=1;BYDAY=MO'::rrule = 'FREQ=WEEKLY;BYDAY=MO'::rrule;
+
+SELECT rule, count(*) FROM (VALUES ('FREQ=WEEKLY;BYDAY=MO'::rrule), ('FREQ=DAILY'), ('FREQ=WEEKLY;INTERVAL=1;BYDAY=MO'), ('FREQ=DAILY')) AS v(rule) GROUP BY rule ORDER BY rule;
+
+SELECT get_rrule(s), get_dtstart(s), get_duration(s) = interval '1 hour' AS one_hour
+    FROM (SELECT 'DTSTART=2024-01-01 09:00:00+00;DURATION=1 hour;FREQ=WEEKLY;BYDAY=MO;COUNT=4'::rrule_series AS s) AS v;
+
+CREATE TEMP TABLE rrule_series_test (id int, s rrule_series);
+
+INSERT INTO rrule_series_test VALUES
+    (1, rrule_series('FREQ=WEEKLY;BYDAY=MO;COUNT=4'::rrule, '2024-01-01 09:00:00+00', '1 hour')),
+    (2, rrule_series('FREQ=DAILY;BYHOUR=12'::rrule, '2024-01-01 12:00:00+00')),
+    (3, rrule_series('FREQ=MONTHLY;BYMONTHDAY=15;UNTIL=20240401T000000Z'::rrule, '2024-01-15 08:00:00+00', '2 hours'));
+
+CREATE INDEX ON rrule_series_test USING gist (s);
+
+SET LOCAL enable_seqscan = off;
+
+SELECT label, array_agg(id ORDER BY id)
+    FROM rrule_series_test, (VALUES
+        (1, tstzrange('2024-01-08 09:30:00+00', '2024-01-08 11:00:00+00')),
+        (2, tstzrange('2024-01-09 10:00:00+00', '2024-01-09 12:00:00+00', '[]')),
+        (3, tstzrange('2024-03-15 09:59:00+00', '2024-03-15 10:00:00+00')),
+        (4, tstzrange('2024-06-01 00:00:00+00', '2024-06-02 00:00:00+00')),
+        (5, tstzrange('2024-01-08 10:00:00+00', '2024-01-08 11:00:00+00'))) AS v(label, w)
+    WHERE s && w
+    GROUP BY label
+    ORDER BY label;
+
+CREATE TEMP TABLE rrule_series_brin_test AS SELECT * FROM rrule_series_test;
+
+CREATE INDEX ON rrule_series_brin_test USING brin (s);
+
+SELECT label, array_agg(id ORDER BY id)
+    FROM rrule_series_brin_test, (VALUES
+        (1, tstzrange('2024-01-08 09:30:00+00', '2024-01-08 11:00:00+00')),
+        (2, tstzrange('2024-06-01 00:00:00+00', '2024-06-02 00:00:00+00')),
+        (3, tstzrange('2023-06-01 00:00:00+00', '2023-06-02 00:00:00+00'))) AS v(label, w)
+    WHERE s && w
+    GROUP BY label
+    ORDER BY label;
+
+DO $$
+DECLARE
+    r rrule := rrule_expand('FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9');
+BEGIN
+    RAISE NOTICE '% % % %', get_freq(r), get_byday(r), get_byhour(r), r = 'FREQ=WEEKLY;BYDAY=MO,WE;BYHOUR=9'::rrule;
+END
+$$;
+
+SELECT hits AS cache_hits, misses AS cache_misses FROM rrule_cache_stats() \gset
+
+CREATE TEMP TABLE rrule_cache_test AS SELECT 'FREQ=DAILY;COUNT=3'::rrule AS r FROM generate_series(1, 5);
+
+SELECT count(*) FROM rrule_cache_test, unnest(get_occurrences(r, '2024-01-01 00:00:00'::timestamp));
+
+SELECT hits - :cache_hits AS hits, misses - :cache_misses AS misses FROM rrule_cache_stats();
+
+SELECT * FROM rrule_occurrences_batch(
+    ARRAY['FREQ=DAILY;COUNT=2', 'FREQ=WEEKLY;COUNT=2', NULL, 'FREQ=DAILY;COUNT=2']::rrule[],
+    ARRAY['2024-01-01 09:00:00', '2024-01-01 09:00:00', '2024-01-01 09:00:00', '2024-01-01 09:00:00']::timestamp[],
+    '2024-01-01 00:00:00', '2024-01-31 00:00:00')
+    ORDER BY idx, occurrence;
+
+SAVEPOINT limits;
+
+SET LOCAL pg_rrule.max_occurrences = 3;
+
+SELECT get_occurrences('FREQ=DAILY'::rrule, '2024-01-01 09:00:00'::timestamp);
+
+ROLLBACK TO SAVEPOINT limits;
+
+SET LOCAL pg_rrule.max_occurrences = 3;
+
+SET LOCAL pg_rrule.limit_action = truncate;
+
+SELECT get_occurrences('FREQ=DAILY'::rrule, '2024-01-01 09:00:00'::timestamp);
+
+ROLLBACK TO SAVEPOINT limits;
+
+-- A cached result must not escape limits lowered since
+SELECT set_config('pg_rrule.max_occurrences', v.max, true) AS max_occurrences,
+       cardinality(get_occurrences('FREQ=DAILY;COUNT=500'::rrule, v.dtstart)) AS occurrences
+FROM (VALUES ('1000', '2024-01-01 09:00:00'::timestamp), ('10', '2024-01-01 09:00:00'::timestamp)) AS v(max, dtstart);
+
+ROLLBACK TO SAVEPOINT limits;
+
+-- Spans, index keys and the && recheck ignore the limits, under either action
+SET LOCAL pg_rrule.max_occurrences = 3;
+
+CREATE TEMP TABLE rrule_limits_test (s rrule_series);
+
+CREATE INDEX ON rrule_limits_test USING gist (s);
+
+INSERT INTO rrule_limits_test VALUES (rrule_series('FREQ=WEEKLY;BYDAY=MO,WE;COUNT=20'::rrule, '2024-01-01 09:00:00+00', '1 hour'));
+
+SELECT rrule_span('FREQ=WEEKLY;BYDAY=MO,WE;COUNT=20'::rrule, '2024-01-01 09:00:00'::timestamp) AS span,
+       (SELECT count(*) FROM rrule_limits_test WHERE s && tstzrange('2024-03-06 09:30:00+00', '2024-03-06 10:00:00+00')) AS overlaps;
+
+SET LOCAL pg_rrule.limit_action = truncate;
+
+SELECT rrule_span('FREQ=WEEKLY;BYDAY=MO,WE;COUNT=20'::rrule, '2024-01-01 09:00:00'::timestamp) AS span,
+       (SELECT count(*) FROM rrule_limits_test WHERE s && tstzrange('2024-03-06 09:30:00+00', '2024-03-06 10:00:00+00')) AS overlaps;
+
+ROLLBACK TO SAVEPOINT limits;
+
+SELECT proname, proparallel FROM pg_proc
+    WHERE prosrc LIKE 'pg\_rrule\_%' AND prolang = (SELECT oid FROM pg_language WHERE lanname = 'c') AND proparallel <> 's'
+    ORDER BY proname;
+
+CREATE FUNCTION pg_temp.estimated_rows(query text) RETURNS float8 LANGUAGE plpgsql AS $$
+DECLARE
+    plan json;
+BEGIN
+    EXECUTE 'EXPLAIN (FORMAT JSON) ' || query INTO plan;
+    RETURN plan->0->'Plan'->>'Plan Rows';
+END
+$$;
+
+SELECT pg_temp.estimated_rows($q$SELECT * FROM rrule_occurrences('FREQ=YEARLY;COUNT=3'::rrule, '2024-01-01 00:00:00'::timestamp)$q$) AS yearly,
+       pg_temp.estimated_rows($q$SELECT * FROM rrule_occurrences('FREQ=WEEKLY;BYDAY=MO,WE,FR'::rrule, '2024-01-01 00:00:00'::timestamp, '2024-01-29 00:00:00'::timestamp)$q$) AS weekly,
+       pg_temp.estimated_rows($q$SELECT * FROM rrule_occurrences('FREQ=MINUTELY'::rrule, '2024-01-01 00:00:00'::timestamp, '2025-01-01 00:00:00'::timestamp)$q$) AS minutely;
+
+CREATE TEMP TABLE rrule_stats_test AS
+    SELECT i,
+           rrule_series('FREQ=DAILY;COUNT=10'::rrule, '2024-01-01 00:00:00+00'::timestamptz + (i % 100) * interval '1 day') AS s,
+           'FREQ=DAILY;COUNT=10'::rrule AS r
+    FROM generate_series(1, 1000) AS i;
+
+ANALYZE rrule_stats_test;
+
+SELECT staattnum, 10731 = ANY (ARRAY[stakind1, stakind2, stakind3, stakind4, stakind5]) AS has_rrule_stats
+    FROM pg_statistic WHERE starelid = 'rrule_stats_test'::regclass AND staattnum > 1 ORDER BY staattnum;
+
+SELECT pg_temp.estimated_rows($q$SELECT * FROM rrule_stats_test WHERE s && '[2024-02-01, 2024-02-02)'::tstzrange$q$) > 10 AS during,
+       pg_temp.estimated_rows($q$SELECT * FROM rrule_stats_test WHERE s && '[2030-01-01, 2030-01-02)'::tstzrange$q$) < 2 AS after,
+       pg_temp.estimated_rows($q$SELECT * FROM rrule_stats_test WHERE rrule_occurs_at(r, '2024-01-01 00:00:00+00', '2024-01-05 00:00:00+00')$q$) < 10 AS occurs_at;
+
 ROLLBACK;
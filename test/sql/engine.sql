@@ -0,0 +1,109 @@
+\set ECHO errors
+BEGIN;
+\i sql/pg_rrule.sql
+\set ECHO all
+
+-- The native engine must produce exactly what libical produces
+CREATE TEMP TABLE rules (rule rrule, dtstart timestamp, until timestamp) ON COMMIT DROP;
+INSERT INTO rules VALUES
+    ('FREQ=SECONDLY;INTERVAL=7;BYSECOND=0,14,21,59', '2024-01-31 23:58:30', '2024-02-01 00:05:00'),
+    ('FREQ=MINUTELY;INTERVAL=13;BYHOUR=0,1', '2024-02-28 23:50:00', '2024-03-02 02:00:00'),
+    ('FREQ=HOURLY;INTERVAL=5;BYMINUTE=0,30', '2023-12-30 22:15:00', '2024-01-05 00:00:00'),
+    ('FREQ=DAILY;INTERVAL=3;BYDAY=MO,WE,FR;BYHOUR=9,17', '2024-01-01 09:00:00', '2024-06-01 00:00:00'),
+    ('FREQ=DAILY;BYMONTH=2;BYMONTHDAY=-1', '2019-01-01 08:00:00', '2025-01-01 00:00:00'),
+    ('FREQ=WEEKLY;INTERVAL=2;WKST=SU;BYDAY=SU,TU,SA', '2024-03-05 12:00:00', '2024-09-01 00:00:00'),
+    ('FREQ=WEEKLY;INTERVAL=3;COUNT=20', '2024-01-03 07:45:00', '2026-01-01 00:00:00'),
+    ('FREQ=MONTHLY;INTERVAL=2;BYMONTHDAY=1,15,-1', '2023-11-15 10:00:00', '2025-01-01 00:00:00'),
+    ('FREQ=MONTHLY;BYDAY=SA,SU;BYMONTHDAY=1,2,3,4,5,6,7', '2024-01-01 00:00:00', '2025-01-01 00:00:00'),
+    ('FREQ=MONTHLY;COUNT=15', '2024-01-31 06:00:00', '2026-01-01 00:00:00'),
+    ('FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=29', '2000-02-29 00:00:00', '2030-01-01 00:00:00'),
+    ('FREQ=YEARLY;INTERVAL=2;BYYEARDAY=1,100,-1', '2020-01-01 12:00:00', '2031-01-01 00:00:00'),
+    ('FREQ=YEARLY;BYDAY=FR;BYMONTHDAY=13', '2015-01-01 00:00:00', '2030-01-01 00:00:00'),
+    ('FREQ=YEARLY;BYMONTH=1,7;BYDAY=MO;BYHOUR=8;BYMINUTE=0;BYSECOND=0', '2024-01-01 08:00:00', '2026-01-01 00:00:00'),
+    ('FREQ=DAILY;UNTIL=20240310T120000Z;BYHOUR=6,18', '2024-03-01 06:00:00', '2024-04-01 00:00:00'),
+    -- Across the DST transitions of Europe/Berlin, for the timestamptz runs below
+    ('FREQ=HOURLY;BYMINUTE=0,30', '2024-03-30 22:00:00', '2024-04-01 00:00:00'),
+    ('FREQ=MINUTELY;INTERVAL=20', '2024-10-26 23:00:00', '2024-10-27 05:00:00'),
+    ('FREQ=DAILY;BYHOUR=2;BYMINUTE=30', '2024-03-25 02:30:00', '2024-11-05 00:00:00');
+
+-- Randomized rules: a seeded mix of FREQ, INTERVAL, COUNT/UNTIL and the BY* parts RFC 5545 allows with each FREQ,
+-- over a window scaled to FREQ
+SELECT setseed(0.5)::text = '' AS seeded;
+
+INSERT INTO rules
+SELECT concat_ws(';',
+           'FREQ=' || freq,
+           'INTERVAL=' || step,
+           CASE WHEN random() < 0.3 THEN 'BYMONTH=' || (ARRAY['1', '2,8', '3,10', '6,7,12'])[1 + floor(random() * 4)::int] END,
+           CASE WHEN freq <> 'WEEKLY' AND random() < 0.3
+                THEN 'BYMONTHDAY=' || (ARRAY['1', '15', '-1', '1,15,31', '29,30', '-2,10'])[1 + floor(random() * 6)::int] END,
+           CASE WHEN freq = 'YEARLY' AND random() < 0.2
+                THEN 'BYYEARDAY=' || (ARRAY['1', '60', '-1', '100,200,366'])[1 + floor(random() * 4)::int] END,
+           CASE WHEN random() < 0.4
+                THEN 'BYDAY=' || (ARRAY['MO', 'SU', 'MO,WE,FR', 'TU,TH', 'SA,SU', 'MO,TU,WE,TH,FR'])[1 + floor(random() * 6)::int] END,
+           CASE WHEN freq NOT IN ('HOURLY', 'MINUTELY', 'SECONDLY') AND random() < 0.4
+                THEN 'BYHOUR=' || (ARRAY['0', '9', '2,3', '6,18', '23'])[1 + floor(random() * 5)::int] END,
+           CASE WHEN freq NOT IN ('MINUTELY', 'SECONDLY') AND random() < 0.3
+                THEN 'BYMINUTE=' || (ARRAY['0', '30', '0,45', '59'])[1 + floor(random() * 4)::int] END,
+           CASE WHEN random() < 0.2 THEN 'BYSECOND=' || (ARRAY['0', '30', '0,59'])[1 + floor(random() * 3)::int] END,
+           CASE WHEN random() < 0.2 THEN 'WKST=' || (ARRAY['SU', 'MO', 'WE'])[1 + floor(random() * 3)::int] END,
+           CASE WHEN ending < 0.3 THEN 'COUNT=' || (1 + floor(random() * 50)::int)
+                WHEN ending < 0.5 THEN 'UNTIL=' || to_char(dtstart + random() * span, 'YYYYMMDD"T"HH24MISS"Z"') END)::rrule,
+       dtstart,
+       dtstart + span
+FROM (
+    SELECT freq,
+           1 + floor(random() * 4)::int AS step,
+           random() AS ending,
+           date_trunc('second', timestamp '2019-01-01 00:00:00' + random() * interval '7 years') AS dtstart,
+           CASE freq WHEN 'SECONDLY' THEN interval '10 minutes'
+                     WHEN 'MINUTELY' THEN interval '1 day'
+                     WHEN 'HOURLY' THEN interval '20 days'
+                     WHEN 'DAILY' THEN interval '1 year'
+                     WHEN 'WEEKLY' THEN interval '3 years'
+                     WHEN 'MONTHLY' THEN interval '6 years'
+                     ELSE interval '30 years' END AS span
+    FROM (SELECT (ARRAY['SECONDLY', 'MINUTELY', 'HOURLY', 'DAILY', 'WEEKLY', 'MONTHLY', 'YEARLY'])[1 + floor(random() * 7)::int] AS freq
+          FROM generate_series(1, 300)) AS f
+) AS d;
+
+-- Every rule expanded as timestamp, then as timestamptz in a zone with DST
+CREATE TEMP TABLE expected (zone text, rule text, occurrence timestamptz) ON COMMIT DROP;
+CREATE TEMP TABLE actual (LIKE expected) ON COMMIT DROP;
+
+SET LOCAL pg_rrule.native_engine = off;
+INSERT INTO expected
+SELECT 'none', r.rule::text, o.occurrence AT TIME ZONE 'UTC'
+FROM rules r, unnest(get_occurrences(r.rule, r.dtstart, r.until)) AS o(occurrence);
+
+SET LOCAL pg_rrule.native_engine = on;
+INSERT INTO actual
+SELECT 'none', r.rule::text, o.occurrence AT TIME ZONE 'UTC'
+FROM rules r, unnest(get_occurrences(r.rule, r.dtstart, r.until)) AS o(occurrence);
+
+SET LOCAL TimeZone = 'Europe/Berlin';
+
+SET LOCAL pg_rrule.native_engine = off;
+INSERT INTO expected
+SELECT 'Europe/Berlin', r.rule::text, o.occurrence
+FROM rules r, unnest(get_occurrences(r.rule, r.dtstart::timestamptz, r.until::timestamptz)) AS o(occurrence);
+
+SET LOCAL pg_rrule.native_engine = on;
+INSERT INTO actual
+SELECT 'Europe/Berlin', r.rule::text, o.occurrence
+FROM rules r, unnest(get_occurrences(r.rule, r.dtstart::timestamptz, r.until::timestamptz)) AS o(occurrence);
+
+SELECT count(DISTINCT zone) = 2 AND count(*) > 1000 AS expanded FROM expected;
+
+SELECT count(*) AS mismatches
+FROM ((TABLE expected EXCEPT ALL TABLE actual) UNION ALL (TABLE actual EXCEPT ALL TABLE expected)) AS diff;
+
+-- Windows and COUNT go through the same engine
+SET LOCAL pg_rrule.native_engine = off;
+SELECT rrule_count_occurrences('FREQ=MONTHLY;COUNT=15'::rrule, '2024-01-31 06:00:00'::timestamp,
+                               '2024-06-01 00:00:00'::timestamp, '2025-06-01 00:00:00'::timestamp);
+SET LOCAL pg_rrule.native_engine = on;
+SELECT rrule_count_occurrences('FREQ=MONTHLY;COUNT=15'::rrule, '2024-01-31 06:00:00'::timestamp,
+                               '2024-06-01 00:00:00'::timestamp, '2025-06-01 00:00:00'::timestamp);
+
+ROLLBACK;